@@ -0,0 +1,425 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <SDL2/SDL.h>
+
+#include "emulator.h"
+
+/* Sound. The board plays recorded effects, switched on by bits of ports 3
+ * and 5. device_out() turns bit changes into start/stop events stamped with
+ * the emulated cycle count and posts them to a single-producer single-consumer
+ * ring. The SDL audio callback drains the ring and mixes the samples, starting
+ * each one at the output sample its cycle stamp maps to, so effects keep the
+ * spacing they had on the emulated clock whatever the host scheduling.
+ *
+ * The emulation thread never waits: if the ring is full the event is dropped
+ * and counted. Samples are loaded from <dir>/0.wav .. 9.wav (the usual
+ * numbering of Space Invaders sample sets) and converted to the output format
+ * up front; missing files get a synthesized stand-in. */
+
+#define AUDIO_FREQ 44100
+#define AUDIO_EVENTS 256 /* ring size, a power of two */
+#define SOUNDS 10
+
+#define EVENT_START 0
+#define EVENT_STOP 1
+#define EVENT_AMP 2 /* amplifier enable, port 3 bit 5 */
+
+#define AMP_BIT 0x20
+
+struct audio_event {
+  uint64_t cycles; /* emulated time of the OUT */
+  uint64_t posted; /* wall time in ns, for measuring latency */
+  uint8_t type;
+  uint8_t sound; /* EVENT_START/STOP: which one; EVENT_AMP: on or off */
+};
+
+struct sound {
+  int16_t *data;
+  uint32_t length;
+};
+
+struct audio {
+  /* Emulation thread */
+  uint8_t ports[6]; /* last values written to ports 3 and 5 */
+  uint64_t dropped; /* events lost to a full ring */
+
+  struct audio_event ring[AUDIO_EVENTS];
+  atomic_uint head; /* next slot to fill, advanced by the emulation thread */
+  atomic_uint tail; /* next slot to drain, advanced by the callback */
+
+  /* Audio callback */
+  SDL_AudioDeviceID device;
+  int freq;
+  int buffer; /* samples per callback */
+  struct sound sounds[SOUNDS];
+  int64_t position[SOUNDS]; /* next sample of each sound, -1 when silent */
+  int amp;
+  uint64_t clock; /* samples output so far */
+  uint64_t anchor_cycles; /* an emulated time ... */
+  uint64_t anchor_sample; /* ... and the output sample it plays at */
+  int anchored;
+
+  uint64_t started; /* sounds started, for the latency average */
+  uint64_t latency_total; /* ns from OUT to the speaker, summed */
+  uint64_t latency_max;
+};
+
+static const struct {
+  uint8_t port;
+  uint8_t bit;
+  uint8_t loop; /* plays until its bit is cleared */
+} sound_map[SOUNDS] = {
+  {3, 0x01, 1}, /* 0: UFO */
+  {3, 0x02, 0}, /* 1: shot */
+  {3, 0x04, 0}, /* 2: player dies */
+  {3, 0x08, 0}, /* 3: invader dies */
+  {5, 0x01, 0}, /* 4-7: fleet movement */
+  {5, 0x02, 0},
+  {5, 0x04, 0},
+  {5, 0x08, 0},
+  {5, 0x10, 0}, /* 8: UFO hit */
+  {3, 0x10, 0}, /* 9: extra life */
+};
+
+/* Stand-ins: a square wave sliding from f0 to f1 Hz, or noise held for `hold`
+ * samples when f0 is 0, fading out unless the sound loops */
+static const struct {
+  int ms;
+  int f0, f1;
+  int hold;
+} synth[SOUNDS] = {
+  {250, 500, 900, 0},
+  {250, 0, 0, 2},
+  {1000, 0, 0, 6},
+  {200, 0, 0, 4},
+  {80, 110, 110, 0},
+  {80, 98, 98, 0},
+  {80, 87, 87, 0},
+  {80, 82, 82, 0},
+  {600, 1000, 200, 0},
+  {1000, 1000, 1000, 0},
+};
+
+static uint64_t now_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void synthesize(struct sound *snd, int id, int freq) {
+  uint32_t i, phase = 0, noise = 1;
+  int level = 0, fade, hz;
+
+  snd->length = (uint32_t) synth[id].ms * freq / 1000;
+  if ((snd->data = malloc(snd->length * sizeof(int16_t))) == NULL)
+    die_error("Could not allocate sound\n");
+
+  for (i = 0; i < snd->length; i++) {
+    fade = sound_map[id].loop ? 4000 : 6000 - (int) ((uint64_t) 6000 * i / snd->length);
+
+    if (synth[id].f0 == 0) {
+      if (i % synth[id].hold == 0) {
+        noise = noise * 1103515245 + 12345;
+        level = (noise >> 16) & 1;
+      }
+    } else {
+      /* 32-bit phase, the top bit is the square wave */
+      hz = synth[id].f0 + (int64_t) (synth[id].f1 - synth[id].f0) * i / snd->length;
+      phase += (uint32_t) (((uint64_t) hz << 32) / freq);
+      level = phase >> 31;
+    }
+
+    snd->data[i] = level ? fade : -fade;
+  }
+}
+
+/* Converts a WAV to mono 16-bit at `freq`. Returns 0 if the format is not one
+ * we read, or if nothing is left at `freq`. */
+static int convert(struct sound *snd, const SDL_AudioSpec *spec, const uint8_t *buf, uint32_t len, int freq) {
+  int bytes = (spec->format == AUDIO_S16LSB) ? 2 : 1;
+  uint32_t frames, i, j;
+  int32_t *mono, v;
+  int c;
+
+  if ((spec->format != AUDIO_U8 && spec->format != AUDIO_S8 && spec->format != AUDIO_S16LSB) ||
+      spec->channels < 1 || spec->freq <= 0)
+    return 0;
+
+  /* mix() needs at least one sample to play */
+  frames = len / (bytes * spec->channels);
+  snd->length = (uint64_t) frames * freq / spec->freq;
+  if (snd->length == 0)
+    return 0;
+
+  if ((mono = malloc(frames * sizeof(int32_t))) == NULL)
+    die_error("Could not allocate sound\n");
+
+  for (i = 0; i < frames; i++) {
+    for (c = 0, v = 0; c < spec->channels; c++) {
+      const uint8_t *p = buf + (i * spec->channels + c) * bytes;
+
+      if (spec->format == AUDIO_U8)
+        v += (p[0] - 128) << 8;
+      else if (spec->format == AUDIO_S8)
+        v += (int8_t) p[0] << 8;
+      else
+        v += (int16_t) (p[0] | p[1] << 8);
+    }
+    mono[i] = v / spec->channels;
+  }
+
+  /* Linear interpolation, 16.16 fixed point source position */
+  if ((snd->data = malloc((snd->length + 1) * sizeof(int16_t))) == NULL)
+    die_error("Could not allocate sound\n");
+
+  for (i = 0; i < snd->length; i++) {
+    uint64_t pos = ((uint64_t) i * spec->freq << 16) / freq;
+    int32_t frac = pos & 0xFFFF;
+
+    j = pos >> 16;
+    snd->data[i] = (j + 1 < frames) ? mono[j] + (((mono[j + 1] - mono[j]) * frac) >> 16) : mono[j];
+  }
+
+  free(mono);
+  return 1;
+}
+
+static void load_sound(struct sound *snd, const char *dir, int id, int freq) {
+  char path[4096];
+  SDL_AudioSpec spec;
+  uint8_t *buf;
+  uint32_t len;
+
+  if (dir) {
+    snprintf(path, sizeof(path), "%s/%d.wav", dir, id);
+
+    if (SDL_LoadWAV(path, &spec, &buf, &len) != NULL) {
+      int ok = convert(snd, &spec, buf, len, freq);
+
+      SDL_FreeWAV(buf);
+      if (ok)
+        return;
+      fprintf(stderr, "%s: unsupported format or empty, using a synthesized sound\n", path);
+    } else {
+      fprintf(stderr, "Could not load %s, using a synthesized sound\n", path);
+    }
+  }
+
+  synthesize(snd, id, freq);
+}
+
+/* Output position of an event, relative to the buffer starting at sample
+ * `start`; `frames` if it falls beyond this buffer */
+static int schedule(struct audio *a, const struct audio_event *e, uint64_t start, int frames) {
+  uint64_t pos = 0, delay = a->buffer + a->freq / 120; /* a buffer plus the burst of a half frame */
+
+  if (a->anchored && e->cycles >= a->anchor_cycles)
+    pos = a->anchor_sample + (e->cycles - a->anchor_cycles) * a->freq / CLOCK_HZ;
+
+  /* First event, or the emulated clock drifted from the audio clock (a
+   * throttle resync, --speed, a rewind): hold this one back by `delay` so the
+   * events after it keep their spacing */
+  if (!a->anchored || e->cycles < a->anchor_cycles || pos < start || pos > start + 2 * delay) {
+    a->anchor_cycles = e->cycles;
+    a->anchor_sample = start + delay;
+    a->anchored = 1;
+    pos = a->anchor_sample;
+  }
+
+  return (pos - start < (uint64_t) frames) ? (int) (pos - start) : frames;
+}
+
+static void apply(struct audio *a, const struct audio_event *e, int offset, uint64_t now) {
+  uint64_t latency;
+
+  switch (e->type) {
+    case EVENT_START:
+      a->position[e->sound] = 0;
+
+      /* Wall time until the callback ran, then until the sample reaches the
+       * speaker: its offset in this buffer plus the one the device holds */
+      latency = (now - e->posted) + (uint64_t) (offset + a->buffer) * 1000000000 / a->freq;
+      a->latency_total += latency;
+      if (latency > a->latency_max)
+        a->latency_max = latency;
+      a->started++;
+      break;
+
+    case EVENT_STOP:
+      a->position[e->sound] = -1;
+      break;
+
+    case EVENT_AMP:
+      a->amp = e->sound;
+      break;
+  }
+}
+
+static void mix(struct audio *a, int16_t *out, int n) {
+  int i, s;
+  int32_t v;
+
+  for (i = 0; i < n; i++) {
+    v = 0;
+
+    for (s = 0; s < SOUNDS; s++) {
+      if (a->position[s] < 0)
+        continue;
+
+      v += a->sounds[s].data[a->position[s]++];
+
+      if (a->position[s] == a->sounds[s].length)
+        a->position[s] = sound_map[s].loop ? 0 : -1;
+    }
+
+    if (!a->amp)
+      v = 0;
+
+    out[i] = v > 32767 ? 32767 : (v < -32768 ? -32768 : v);
+  }
+}
+
+static void callback(void *userdata, Uint8 *stream, int len) {
+  struct audio *a = userdata;
+  int16_t *out = (int16_t *) stream;
+  int frames = len / sizeof(int16_t), done = 0, at;
+  unsigned tail = atomic_load_explicit(&a->tail, memory_order_relaxed);
+  unsigned head = atomic_load_explicit(&a->head, memory_order_acquire);
+  const struct audio_event *e;
+  uint64_t now = now_ns();
+
+  while (done < frames) {
+    e = &a->ring[tail % AUDIO_EVENTS];
+    at = (tail != head) ? schedule(a, e, a->clock, frames) : frames;
+
+    if (at < done)
+      at = done;
+
+    mix(a, out + done, at - done);
+    done = at;
+
+    if (at < frames) {
+      apply(a, e, at, now);
+      tail++;
+    }
+  }
+
+  atomic_store_explicit(&a->tail, tail, memory_order_release);
+  a->clock += frames;
+}
+
+/* Opens the audio device with a `buffer`-sample callback. Sound is optional,
+ * so failures only warn. */
+void audio_init(struct machine *m, const char *sample_dir, int buffer) {
+  SDL_AudioSpec want, have;
+  struct audio *a;
+  int i;
+
+  if ((a = calloc(1, sizeof(struct audio))) == NULL)
+    die_error("Could not allocate audio\n");
+
+  memset(&want, 0, sizeof(want));
+  want.freq = AUDIO_FREQ;
+  want.format = AUDIO_S16SYS;
+  want.channels = 1;
+  want.samples = buffer;
+  want.callback = callback;
+  want.userdata = a;
+
+  if ((a->device = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0)) == 0) {
+    fprintf(stderr, "SDL_OpenAudioDevice(): %s, continuing without sound\n", SDL_GetError());
+    free(a);
+    return;
+  }
+
+  a->freq = have.freq;
+  a->buffer = have.samples;
+
+  for (i = 0; i < SOUNDS; i++) {
+    load_sound(&a->sounds[i], sample_dir, i, a->freq);
+    a->position[i] = -1;
+  }
+
+  atomic_init(&a->head, 0);
+  atomic_init(&a->tail, 0);
+  m->audio = a;
+
+  SDL_PauseAudioDevice(a->device, 0);
+}
+
+static void post(struct machine *m, uint8_t type, uint8_t sound) {
+  struct audio *a = m->audio;
+  unsigned head = atomic_load_explicit(&a->head, memory_order_relaxed);
+  struct audio_event *e;
+
+  if (head - atomic_load_explicit(&a->tail, memory_order_acquire) == AUDIO_EVENTS) {
+    a->dropped++;
+    return;
+  }
+
+  e = &a->ring[head % AUDIO_EVENTS];
+  e->cycles = m->state.cycles;
+  e->posted = now_ns();
+  e->type = type;
+  e->sound = sound;
+
+  atomic_store_explicit(&a->head, head + 1, memory_order_release);
+}
+
+/* OUT to port 3 or 5 */
+void audio_out(struct machine *m, int port, uint8_t byte) {
+  struct audio *a = m->audio;
+  uint8_t changed = byte ^ a->ports[port];
+  int i;
+
+  a->ports[port] = byte;
+
+  if (port == 3 && (changed & AMP_BIT))
+    post(m, EVENT_AMP, (byte & AMP_BIT) != 0);
+
+  for (i = 0; i < SOUNDS; i++) {
+    if (sound_map[i].port != port || !(changed & sound_map[i].bit))
+      continue;
+
+    if (byte & sound_map[i].bit)
+      post(m, EVENT_START, i);
+    else if (sound_map[i].loop)
+      post(m, EVENT_STOP, i);
+  }
+}
+
+/* Stops the device and reports latency. The rest stays allocated, as the
+ * emulation thread may still be posting. */
+void audio_close(struct machine *m) {
+  struct audio *a = m->audio;
+
+  if (a == NULL || a->device == 0)
+    return;
+
+  SDL_CloseAudioDevice(a->device);
+  a->device = 0;
+
+  printf("audio:        %llu sounds, latency %.1f ms average, %.1f ms max, %llu events dropped, "
+         "%d-sample buffer (%.1f ms)\n",
+         (unsigned long long) a->started, a->started ? a->latency_total / 1e6 / a->started : 0.0,
+         a->latency_max / 1e6, (unsigned long long) a->dropped, a->buffer, a->buffer * 1000.0 / a->freq);
+}
+
+void audio_free(struct machine *m) {
+  struct audio *a = m->audio;
+  int i;
+
+  if (a == NULL)
+    return;
+
+  audio_close(m);
+  for (i = 0; i < SOUNDS; i++)
+    free(a->sounds[i].data);
+  free(a);
+  m->audio = NULL;
+}
@@ -0,0 +1,44 @@
+#!/bin/sh
+# Runs the headless benchmark suite and writes the results as CSV and JSON.
+#
+#   ./bench.sh [EMULATOR] [ROM]
+#
+# FRAMES sets how many frames each workload runs for (default 6000, i.e.
+# 100 s of emulated time). Results go to bench.csv and bench.json. Idle loops
+# are not skipped, so every cycle is emulated and the figures stay comparable
+# with runs from before idle skipping existed.
+
+EMU=${1:-./emulator-bench}
+ROM=${2:-invaders.rom}
+FRAMES=${FRAMES:-6000}
+CSV=bench.csv
+JSON=bench.json
+
+echo "workload,core,instructions,cycles,frames,seconds,mips,emulated_mhz,ns_per_frame,peak_rss_kb,idle_cycles" > $CSV
+
+for core in switch dispatch jit; do
+  for workload in rom alu memory branch call; do
+    if [ $workload = rom ]; then
+      source="$ROM"
+    else
+      source="--kernel=$workload"
+    fi
+
+    line=$($EMU --core=$core --headless --no-idle --csv --frames=$FRAMES $source) || exit 1
+    echo "$workload,$core,$line" >> $CSV
+  done
+done
+
+# Turn the CSV into an array of objects; every column but the first two is numeric
+awk -F, '
+  NR == 1 { for (i = 1; i <= NF; i++) key[i] = $i; next }
+  {
+    printf "%s  {", (NR > 2 ? ",\n" : "[\n")
+    for (i = 1; i <= NF; i++)
+      printf "%s\"%s\": %s", (i > 1 ? ", " : ""), key[i], (i <= 2 ? "\"" $i "\"" : $i)
+    printf "}"
+  }
+  END { print "\n]" }
+' $CSV > $JSON
+
+column -s, -t < $CSV 2>/dev/null || cat $CSV
@@ -0,0 +1,113 @@
+#include "emulator.h"
+
+/* Memory bus. The address space is split into 256 pages of 256 bytes, each
+ * mapped onto a page of memory[], so mirrors cost
+ * nothing: they simply point at the same storage. Loads are a single lookup
+ * in bus.read. Stores use bus.write, which is only set for plain RAM nobody is
+ * watching; everything else comes here. Watches are kept per page of
+ * memory[], so a store through a mirror is seen like any other. */
+
+/* Recomputes the host pointers of guest `page` */
+static void refresh(struct machine *m, int page) {
+  struct bus *b = &m->bus;
+
+  b->read[page] = m->memory + (b->phys[page] << 8);
+  b->write[page] = ((b->flags[page] & PAGE_ROM) || b->watch[b->phys[page]]) ? NULL : b->read[page];
+}
+
+/* Maps `count` guest pages from `page` onto memory[] from page `phys` */
+void bus_map(struct machine *m, int page, int count, int phys, uint8_t flags) {
+  int i;
+
+  for (i = 0; i < count; i++) {
+    m->bus.flags[page + i] = flags;
+    m->bus.phys[page + i] = phys + i;
+    refresh(m, page + i);
+  }
+
+  flush_fused(m);
+}
+
+/* 8K of ROM, 1K of work RAM and 7K of VRAM. The board decodes 14 address
+ * lines, so the whole 16K repeats up to the top of the address space. */
+void bus_map_invaders(struct machine *m) {
+  int page;
+
+  bus_map(m, 0x00, 0x20, 0x00, PAGE_ROM);
+  bus_map(m, 0x20, 0x20, 0x20, PAGE_RAM);
+
+  for (page = 0x40; page < BUS_PAGES; page += 0x40) {
+    bus_map(m, page, 0x20, 0x00, PAGE_ROM);
+    bus_map(m, page + 0x20, 0x20, 0x20, PAGE_RAM);
+  }
+
+  for (page = VRAM_START >> 8; page < (VRAM_START + VRAM_SIZE) >> 8; page++)
+    bus_watch(m, page, WATCH_VRAM);
+}
+
+/* Points the page table at this machine's memory, after it was copied */
+void bus_rebase(struct machine *m) {
+  int page;
+
+  for (page = 0; page < BUS_PAGES; page++)
+    refresh(m, page);
+}
+
+/* Applies a watch change on page `phys` of memory[] to every guest page
+ * mapped onto it */
+static void refresh_phys(struct machine *m, int phys) {
+  int page;
+
+  for (page = 0; page < BUS_PAGES; page++)
+    if (m->bus.phys[page] == phys)
+      refresh(m, page);
+}
+
+void bus_watch(struct machine *m, int phys, uint8_t reasons) {
+  if ((m->bus.watch[phys] & reasons) == reasons)
+    return;
+
+  m->bus.watch[phys] |= reasons;
+  refresh_phys(m, phys);
+}
+
+void bus_unwatch(struct machine *m, int phys, uint8_t reasons) {
+  if ((m->bus.watch[phys] & reasons) == 0)
+    return;
+
+  m->bus.watch[phys] &= ~reasons;
+  refresh_phys(m, phys);
+}
+
+/* The slow path of write_memory() */
+void bus_write(struct machine *m, uint16_t addr, uint8_t byte) {
+  int page = addr >> 8;
+  uint8_t flags = m->bus.flags[page], watch;
+  uint16_t phys, vram;
+
+  if (flags & PAGE_ROM)
+    return;
+
+  phys = (m->bus.phys[page] << 8) | (addr & 0xFF);
+  watch = m->bus.watch[phys >> 8];
+
+  if (m->memory[phys] == byte)
+    return;
+
+  if ((watch & WATCH_CODE) && (m->code_bytes[phys >> 6] >> (phys & 63) & 1)) {
+    m->code_dirty = 1;
+    m->code_dirty_bytes[phys >> 6] |= (uint64_t) 1 << (phys & 63);
+  }
+
+  if (watch & WATCH_VRAM) {
+    vram = phys - VRAM_START;
+    m->vram_dirty[vram >> 6] |= (uint64_t) 1 << (vram & 63);
+  }
+
+  if (watch & WATCH_DIRTY) {
+    m->page_dirty[phys >> 14] |= (uint64_t) 1 << ((phys >> 8) & 63);
+    bus_unwatch(m, phys >> 8, WATCH_DIRTY); /* once a frame is enough */
+  }
+
+  m->memory[phys] = byte;
+}
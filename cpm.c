@@ -0,0 +1,81 @@
+#include <stdio.h>
+#include <string.h>
+#include "emulator.h"
+
+/* A minimal CP/M environment, enough for console programs such as the 8080
+ * exercisers (TST8080, 8080PRE, CPUTEST, 8080EXM). The .COM file is loaded at
+ * 0x0100. The BDOS entry at 0x0005 jumps to a stub at the top of memory that
+ * hands the call to us through an OUT, so the cores need no special casing;
+ * warm boot (a jump to 0x0000) does the same to stop the machine. Only
+ * console output, BDOS functions 2 and 9, is implemented. */
+
+#define TPA 0x0100 /* where .COM files are loaded */
+#define BDOS_STUB 0xFE00 /* also the top of the TPA, which programs read from 0x0006 */
+#define BDOS_PORT 0xFE
+#define BOOT_PORT 0xFF
+
+void load_com(struct machine *m, char *path) {
+  /* OUT BOOT_PORT; HLT */
+  static const uint8_t boot[] = {0xd3, BOOT_PORT, 0x76};
+  /* JMP BDOS_STUB */
+  static const uint8_t entry[] = {0xc3, BDOS_STUB & 0xFF, BDOS_STUB >> 8};
+  /* OUT BDOS_PORT; RET */
+  static const uint8_t stub[] = {0xd3, BDOS_PORT, 0xc9};
+  FILE *fp;
+  int page;
+
+  if ((fp = fopen(path, "rb")) == NULL)
+    die_error("Could not open %s\n", path);
+
+  fread(m->memory + TPA, 1, BDOS_STUB - TPA, fp);
+  fclose(fp);
+
+  /* CP/M machines have RAM all the way up */
+  bus_map(m, 0, BUS_PAGES, 0, PAGE_RAM);
+  for (page = 0; page < BUS_PAGES; page++)
+    bus_unwatch(m, page, WATCH_VRAM);
+
+  memcpy(m->memory, boot, sizeof(boot));
+  memcpy(m->memory + 0x0005, entry, sizeof(entry));
+  memcpy(m->memory + BDOS_STUB, stub, sizeof(stub));
+
+  /* The CCP calls the program, so a RET also warm boots */
+  m->state.sp = BDOS_STUB;
+  push_stack(m, 0x0000);
+
+  m->state.pc = TPA;
+  m->state.interrupts_enabled = 0;
+  m->state.next_interrupt = UINT64_MAX; /* no screen, so no screen interrupts */
+  m->cpm = 1;
+}
+
+static void bdos(struct machine *m) {
+  uint16_t addr;
+
+  switch (m->state.reg_c) {
+    case 2: /* console output */
+      putchar(m->state.reg_e);
+      break;
+
+    case 9: /* print string terminated by '$' */
+      for (addr = get_register_pair(m, DE); read_memory(m, addr) != '$'; addr++)
+        putchar(read_memory(m, addr));
+      break;
+  }
+
+  fflush(stdout);
+}
+
+/* OUT handler for the CP/M ports */
+void cpm_out(struct machine *m, int dev) {
+  switch (dev) {
+    case BDOS_PORT:
+      bdos(m);
+      break;
+
+    case BOOT_PORT:
+      m->stopped = 1;
+      end_batch(m, RUN_STOP);
+      break;
+  }
+}
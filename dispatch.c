@@ -0,0 +1,606 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emulator.h"
+
+/* Table-driven interpreter core. Every opcode is decoded once at startup into
+ * a handler pointer plus its operands, so executing an instruction costs one
+ * table load and one indirect call instead of the switch/mask cascade in
+ * execute(). Register operands are stored as indices into m->state.regs[],
+ * pair operands as indices into m->state.pairs[]. */
+
+#define REG(i) (m->state.regs[i])
+#define PAIR(i) (m->state.pairs[i])
+#define HL_ADDR() PAIR(HL)
+#define IMM16() (((uint16_t) read_memory(m, m->state.pc + 1) << 8) | (uint16_t) read_memory(m, m->state.pc))
+
+struct op dispatch_table[256];
+
+static void op_nop(struct machine *m, const struct op *op) {
+}
+
+static void op_hlt(struct machine *m, const struct op *op) {
+  printf("HLT: Exiting program\n");
+  exit(0);
+}
+
+static void op_unknown(struct machine *m, const struct op *op) {
+  die_error("Unsupported opcode: %x\n", read_memory(m, (uint16_t) (m->state.pc - 1)));
+  exit(-1);
+}
+
+/* Data transfer */
+
+static void op_mov(struct machine *m, const struct op *op) {
+  REG(op->a) = REG(op->b);
+}
+
+static void op_mov_from_m(struct machine *m, const struct op *op) {
+  REG(op->a) = read_memory(m, HL_ADDR());
+}
+
+static void op_mov_to_m(struct machine *m, const struct op *op) {
+  write_memory(m, HL_ADDR(), REG(op->b));
+}
+
+static void op_mvi(struct machine *m, const struct op *op) {
+  REG(op->a) = read_memory(m, m->state.pc++);
+}
+
+static void op_mvi_m(struct machine *m, const struct op *op) {
+  write_memory(m, HL_ADDR(), read_memory(m, m->state.pc++));
+}
+
+static void op_lxi(struct machine *m, const struct op *op) {
+  PAIR(op->a) = IMM16();
+  m->state.pc += 2;
+}
+
+static void op_lxi_sp(struct machine *m, const struct op *op) {
+  m->state.sp = IMM16();
+  m->state.pc += 2;
+}
+
+static void op_ldax(struct machine *m, const struct op *op) {
+  m->state.reg_a = read_memory(m, PAIR(op->a));
+}
+
+static void op_stax(struct machine *m, const struct op *op) {
+  write_memory(m, PAIR(op->a), m->state.reg_a);
+}
+
+static void op_inx(struct machine *m, const struct op *op) {
+  PAIR(op->a)++;
+}
+
+static void op_dcx(struct machine *m, const struct op *op) {
+  PAIR(op->a)--;
+}
+
+static void op_inx_sp(struct machine *m, const struct op *op) {
+  m->state.sp++;
+}
+
+static void op_dcx_sp(struct machine *m, const struct op *op) {
+  m->state.sp--;
+}
+
+static void op_direct_address(struct machine *m, const struct op *op) {
+  direct_address(m, op->a, IMM16());
+  m->state.pc += 2;
+}
+
+static void op_xchg(struct machine *m, const struct op *op) {
+  xchg(m);
+}
+
+static void op_xthl(struct machine *m, const struct op *op) {
+  xthl(m);
+}
+
+static void op_sphl(struct machine *m, const struct op *op) {
+  m->state.sp = PAIR(HL);
+}
+
+static void op_pchl(struct machine *m, const struct op *op) {
+  m->state.pc = PAIR(HL);
+}
+
+/* Arithmetic and logic -- flag semantics stay in instructions.c */
+
+static void op_alu(struct machine *m, const struct op *op) {
+  arithmetic_logic(m, op->a, REG(op->b));
+}
+
+static void op_alu_m(struct machine *m, const struct op *op) {
+  arithmetic_logic(m, op->a, read_memory(m, HL_ADDR()));
+}
+
+static void op_alu_imm(struct machine *m, const struct op *op) {
+  arithmetic_logic(m, op->a, read_memory(m, m->state.pc));
+  m->state.pc++;
+}
+
+static void op_inr(struct machine *m, const struct op *op) {
+  increment(m, op->a);
+}
+
+static void op_dcr(struct machine *m, const struct op *op) {
+  decrement(m, op->a);
+}
+
+static void op_dad(struct machine *m, const struct op *op) {
+  dad(m, op->a);
+}
+
+static void op_rotate(struct machine *m, const struct op *op) {
+  rotate(m, op->a);
+}
+
+static void op_stc(struct machine *m, const struct op *op) {
+  m->state.flag_cy = 1;
+}
+
+static void op_cmc(struct machine *m, const struct op *op) {
+  m->state.flag_cy = !m->state.flag_cy;
+}
+
+static void op_cma(struct machine *m, const struct op *op) {
+  m->state.reg_a = ~m->state.reg_a;
+}
+
+/* Branches -- a = condition, b = condflg as decoded by execute() */
+
+static void op_jmp(struct machine *m, const struct op *op) {
+  m->state.pc = IMM16();
+}
+
+static void op_jcond(struct machine *m, const struct op *op) {
+  if (get_cond(m, op->a, 1, op->b))
+    m->state.pc = IMM16();
+  else
+    m->state.pc += 2;
+}
+
+static void op_call(struct machine *m, const struct op *op) {
+  uint16_t addr = IMM16();
+  push_stack(m, m->state.pc + 2);
+  m->state.pc = addr;
+}
+
+static void op_ccond(struct machine *m, const struct op *op) {
+  uint16_t addr = IMM16();
+  m->state.pc += 2;
+
+  if (get_cond(m, op->a, 2, op->b)) {
+    if (!op->b)
+      m->state.cycles += COND_TAKEN_CYCLES;
+    push_stack(m, m->state.pc);
+    m->state.pc = addr;
+  }
+}
+
+static void op_ret(struct machine *m, const struct op *op) {
+  m->state.pc = pop_stack(m);
+}
+
+static void op_rcond(struct machine *m, const struct op *op) {
+  if (get_cond(m, op->a, 0, op->b)) {
+    if (!op->b)
+      m->state.cycles += COND_TAKEN_CYCLES;
+    m->state.pc = pop_stack(m);
+  }
+}
+
+static void op_rst(struct machine *m, const struct op *op) {
+  push_stack(m, m->state.pc);
+  m->state.pc = op->a << 3;
+}
+
+/* Stack */
+
+static void op_push(struct machine *m, const struct op *op) {
+  push(m, op->a);
+}
+
+static void op_pop(struct machine *m, const struct op *op) {
+  pop(m, op->a);
+}
+
+/* Machine control and I/O */
+
+static void op_ei(struct machine *m, const struct op *op) {
+  m->state.interrupts_enabled = 1;
+}
+
+static void op_di(struct machine *m, const struct op *op) {
+  m->state.interrupts_enabled = 0;
+}
+
+static void op_daa(struct machine *m, const struct op *op) {
+  daa(m);
+}
+
+static void op_in(struct machine *m, const struct op *op) {
+  m->state.reg_a = m->state.input_pins[read_memory(m, m->state.pc)];
+  m->state.pc += 1;
+}
+
+static void op_out(struct machine *m, const struct op *op) {
+  device_out(m, read_memory(m, m->state.pc), m->state.reg_a);
+  m->state.pc += 1;
+}
+
+static void set_op(uint8_t opcode, void (*fn)(struct machine *, const struct op *), uint8_t a, uint8_t b) {
+  dispatch_table[opcode].fn = fn;
+  dispatch_table[opcode].a = a;
+  dispatch_table[opcode].b = b;
+}
+
+/* Decodes all 256 opcodes as opcode_specs[] describes them; the operands
+ * come from the opcode's bits, as in execute() */
+void init_dispatch() {
+  int opcode, dst, src, rp;
+
+  for (opcode = 0; opcode < 256; opcode++) {
+    dst = (opcode >> 3) & 0x7;
+    src = opcode & 0x7;
+    rp = (opcode >> 4) & 0x3;
+
+    switch (opcode_specs[opcode].type) {
+      case TYPE_MOV:
+        if (dst == MEM_REF)
+          set_op(opcode, op_mov_to_m, 0, REG_INDEX(src));
+        else if (src == MEM_REF)
+          set_op(opcode, op_mov_from_m, REG_INDEX(dst), 0);
+        else
+          set_op(opcode, op_mov, REG_INDEX(dst), REG_INDEX(src));
+        break;
+
+      case TYPE_ALR:
+        if (src == MEM_REF)
+          set_op(opcode, op_alu_m, dst, 0);
+        else
+          set_op(opcode, op_alu, dst, REG_INDEX(src));
+        break;
+
+      case TYPE_ALI:
+        set_op(opcode, op_alu_imm, dst, 0);
+        break;
+
+      case TYPE_INR:
+        set_op(opcode, op_inr, dst, 0);
+        break;
+
+      case TYPE_DCR:
+        set_op(opcode, op_dcr, dst, 0);
+        break;
+
+      case TYPE_MVI:
+        if (dst == MEM_REF)
+          set_op(opcode, op_mvi_m, 0, 0);
+        else
+          set_op(opcode, op_mvi, REG_INDEX(dst), 0);
+        break;
+
+      case TYPE_RST:
+        set_op(opcode, op_rst, dst, 0);
+        break;
+
+      /* The odd encodings 11xxx001/011/101 decode with condflg set, exactly
+       * like execute(); the real unconditional forms are overridden below */
+      case TYPE_JUMP:
+        switch ((opcode >> 1) & 0x3) {
+          case 0: /* RET */
+            set_op(opcode, op_rcond, dst, opcode & 0x1);
+            break;
+          case 1: /* JMP */
+            set_op(opcode, op_jcond, dst, opcode & 0x1);
+            break;
+          case 2: /* CALL */
+            set_op(opcode, op_ccond, dst, opcode & 0x1);
+            break;
+        }
+        break;
+
+      case TYPE_DAD:
+        set_op(opcode, op_dad, rp, 0);
+        break;
+
+      case TYPE_POP:
+        set_op(opcode, op_pop, rp, 0);
+        break;
+
+      case TYPE_PUSH:
+        set_op(opcode, op_push, rp, 0);
+        break;
+
+      case TYPE_LXI:
+        if (rp == SP)
+          set_op(opcode, op_lxi_sp, 0, 0);
+        else
+          set_op(opcode, op_lxi, rp, 0);
+        break;
+
+      case TYPE_INX:
+        if (rp == SP)
+          set_op(opcode, op_inx_sp, 0, 0);
+        else
+          set_op(opcode, op_inx, rp, 0);
+        break;
+
+      case TYPE_DCX:
+        if (rp == SP)
+          set_op(opcode, op_dcx_sp, 0, 0);
+        else
+          set_op(opcode, op_dcx, rp, 0);
+        break;
+
+      case TYPE_STAX:
+        set_op(opcode, op_stax, rp, 0);
+        break;
+
+      case TYPE_LDAX:
+        set_op(opcode, op_ldax, rp, 0);
+        break;
+
+      case TYPE_ROT:
+        set_op(opcode, op_rotate, dst & 0x3, 0);
+        break;
+
+      case TYPE_DIR_ADDR:
+        set_op(opcode, op_direct_address, dst & 0x3, 0);
+        break;
+
+      case TYPE_NOP: set_op(opcode, op_nop, 0, 0); break;
+      case TYPE_HLT: set_op(opcode, op_hlt, 0, 0); break;
+      case TYPE_EI: set_op(opcode, op_ei, 0, 0); break;
+      case TYPE_DI: set_op(opcode, op_di, 0, 0); break;
+      case TYPE_XCHG: set_op(opcode, op_xchg, 0, 0); break;
+      case TYPE_XTHL: set_op(opcode, op_xthl, 0, 0); break;
+      case TYPE_SPHL: set_op(opcode, op_sphl, 0, 0); break;
+      case TYPE_PCHL: set_op(opcode, op_pchl, 0, 0); break;
+      case TYPE_STC: set_op(opcode, op_stc, 0, 0); break;
+      case TYPE_CMC: set_op(opcode, op_cmc, 0, 0); break;
+      case TYPE_CMA: set_op(opcode, op_cma, 0, 0); break;
+      case TYPE_DAA: set_op(opcode, op_daa, 0, 0); break;
+      case TYPE_IN: set_op(opcode, op_in, 0, 0); break;
+      case TYPE_OUT: set_op(opcode, op_out, 0, 0); break;
+
+      default:
+        set_op(opcode, op_unknown, 0, 0);
+        break;
+    }
+  }
+
+  /* The unconditional branches need no condition check */
+  set_op(0xC3, op_jmp, 0, 0);
+  set_op(0xCD, op_call, 0, 0);
+  set_op(0xC9, op_ret, 0, 0);
+}
+
+/* Fetches and executes one instruction through the dispatch table */
+void step_dispatch(struct machine *m) {
+  PROFILE_BEGIN(m);
+  uint8_t opcode = read_memory(m, m->state.pc++);
+  const struct op *op = &dispatch_table[opcode];
+
+  m->state.cycles += opcode_cycles[opcode];
+  op->fn(m, op);
+  PROFILE_END(m);
+}
+
+/* Superinstructions. The first time the core reaches an address it decodes
+ * what starts there into m->fused[], and the hot sequences listed in
+ * emulator.h then run through one handler that knows the opcodes already.
+ * Each part still does what its own handler would, and the handlers stop
+ * between parts once run_limit is reached, leaving pc on the next part, so a
+ * batch ends (and an interrupt is taken) after the same instruction as when
+ * stepping. Only sequences in ROM are fused, as nothing the guest does can
+ * change them; stores to RAM would otherwise have to invalidate m->fused. */
+
+#define NOT_DECODED 0
+#define NOT_FUSED 1 /* otherwise FUSE_* + 2 */
+
+#define DUE() (m->state.cycles >= m->run_limit)
+
+static const char *const fuse_names[FUSE_KINDS] = {
+  "DCR r; JNZ", "ANA/ORA A; Jcc", "LDA; DCR A; JNZ", "LDA; ANA/ORA A; Jcc", "LXI H; store M", "LDAX D; MOV M,A; INX"
+};
+
+static uint16_t imm16_at(struct machine *m, uint16_t addr) {
+  return ((uint16_t) read_memory(m, addr + 1) << 8) | (uint16_t) read_memory(m, addr);
+}
+
+/* JZ or JNZ at pc, after the flags were set */
+static void fused_jcc(struct machine *m, uint8_t opcode) {
+  m->state.cycles += opcode_cycles[opcode];
+
+  if (flag_z(&m->state) == (opcode == 0xCA))
+    m->state.pc = imm16_at(m, m->state.pc + 1);
+  else
+    m->state.pc += 3;
+}
+
+static int fuse_dcr_jnz(struct machine *m) {
+  uint8_t dcr = read_memory(m, m->state.pc);
+
+  m->state.cycles += opcode_cycles[dcr];
+  decrement(m, (dcr >> 3) & 0x7);
+  m->state.pc++;
+  if (DUE())
+    return 1;
+
+  fused_jcc(m, 0xC2);
+  return 2;
+}
+
+static int fuse_test_jcc(struct machine *m) {
+  uint8_t test = read_memory(m, m->state.pc);
+
+  m->state.cycles += opcode_cycles[test];
+  arithmetic_logic(m, (test >> 3) & 0x7, m->state.reg_a);
+  m->state.pc++;
+  if (DUE())
+    return 1;
+
+  fused_jcc(m, read_memory(m, m->state.pc));
+  return 2;
+}
+
+/* LDA, then one of the above */
+static int fused_lda(struct machine *m) {
+  m->state.cycles += opcode_cycles[0x3A];
+  m->state.reg_a = read_memory(m, imm16_at(m, m->state.pc + 1));
+  m->state.pc += 3;
+  return 1;
+}
+
+static int fuse_lda_dcr_jnz(struct machine *m) {
+  fused_lda(m);
+  return DUE() ? 1 : 1 + fuse_dcr_jnz(m);
+}
+
+static int fuse_lda_test_jcc(struct machine *m) {
+  fused_lda(m);
+  return DUE() ? 1 : 1 + fuse_test_jcc(m);
+}
+
+static int fuse_lxi_h_store(struct machine *m) {
+  uint8_t store;
+
+  m->state.cycles += opcode_cycles[0x21];
+  PAIR(HL) = imm16_at(m, m->state.pc + 1);
+  m->state.pc += 3;
+  if (DUE())
+    return 1;
+
+  store = read_memory(m, m->state.pc);
+  m->state.cycles += opcode_cycles[store];
+  if (store == 0x36) { /* MVI M */
+    write_memory(m, HL_ADDR(), read_memory(m, m->state.pc + 1));
+    m->state.pc += 2;
+  } else {
+    write_memory(m, HL_ADDR(), get_register_content(m, store & 0x7));
+    m->state.pc++;
+  }
+  return 2;
+}
+
+static int fuse_copy(struct machine *m) {
+  uint8_t opcode;
+  int n;
+
+  m->state.cycles += opcode_cycles[0x1A];
+  m->state.reg_a = read_memory(m, PAIR(DE));
+  m->state.pc++;
+  if (DUE())
+    return 1;
+
+  m->state.cycles += opcode_cycles[0x77];
+  write_memory(m, HL_ADDR(), m->state.reg_a);
+  m->state.pc++;
+
+  /* INX H and INX D, each at most once */
+  for (n = 2; n < 4 && !DUE(); n++) {
+    opcode = read_memory(m, m->state.pc);
+    if ((opcode != 0x23 && opcode != 0x13) || (n == 3 && opcode == read_memory(m, m->state.pc - 1)))
+      break;
+
+    m->state.cycles += opcode_cycles[opcode];
+    PAIR((opcode == 0x23) ? HL : DE)++;
+    m->state.pc++;
+  }
+  return n;
+}
+
+static int (*const fuse_fn[FUSE_KINDS])(struct machine *m) = {
+  fuse_dcr_jnz, fuse_test_jcc, fuse_lda_dcr_jnz, fuse_lda_test_jcc, fuse_lxi_h_store, fuse_copy
+};
+
+static int is_dcr_jnz(const uint8_t *code) {
+  return (code[0] & 0xC7) == 0x05 && code[0] != 0x35 && code[1] == 0xC2;
+}
+
+static int is_test_jcc(const uint8_t *code) {
+  return (code[0] == 0xA7 || code[0] == 0xB7) && (code[1] == 0xC2 || code[1] == 0xCA);
+}
+
+/* The sequence starting at `pc`, NOT_FUSED or FUSE_* + 2 */
+static uint8_t decode_fused(struct machine *m, uint16_t pc) {
+  uint8_t code[6];
+  int i, kind = -1;
+
+#ifdef PROFILE
+  return NOT_FUSED; /* the profiler wants to see every instruction */
+#endif
+
+  /* Fused code must not change under us: ROM only, and all in the address space */
+  if (pc > MEMSIZE - sizeof(code))
+    return NOT_FUSED;
+  for (i = 0; i < (int) sizeof(code); i++) {
+    if (!(m->bus.flags[(pc + i) >> 8] & PAGE_ROM))
+      return NOT_FUSED;
+    code[i] = read_memory(m, pc + i);
+  }
+
+  if (is_dcr_jnz(code))
+    kind = FUSE_DCR_JNZ;
+  else if (is_test_jcc(code))
+    kind = FUSE_TEST_JCC;
+  else if (code[0] == 0x3A && code[3] == 0x3D && code[4] == 0xC2)
+    kind = FUSE_LDA_DCR_JNZ;
+  else if (code[0] == 0x3A && is_test_jcc(code + 3))
+    kind = FUSE_LDA_TEST_JCC;
+  else if (code[0] == 0x21 && (code[3] == 0x36 || (code[3] >= 0x70 && code[3] <= 0x77 && code[3] != 0x76)))
+    kind = FUSE_LXI_H_STORE;
+  else if (code[0] == 0x1A && code[1] == 0x77)
+    kind = FUSE_COPY;
+
+  return (kind < 0) ? NOT_FUSED : kind + 2;
+}
+
+/* Forgets what was decoded, for when the memory map changes */
+void flush_fused(struct machine *m) {
+  memset(m->fused, NOT_DECODED, sizeof(m->fused));
+}
+
+void print_fuse_stats(struct machine *m) {
+  uint64_t instructions = 0;
+  int kind;
+
+  for (kind = 0; kind < FUSE_KINDS; kind++)
+    instructions += m->fuse_instructions[kind];
+
+  printf("fused:        %llu instructions (%.1f%%)\n", (unsigned long long) instructions,
+         m->instructions ? 100.0 * instructions / m->instructions : 0.0);
+  for (kind = 0; kind < FUSE_KINDS; kind++)
+    printf("  %-22s %12llu runs %12llu instructions\n", fuse_names[kind], (unsigned long long) m->fuse_runs[kind],
+           (unsigned long long) m->fuse_instructions[kind]);
+}
+
+/* The dispatch core's batch loop, see run_until() */
+uint64_t run_dispatch(struct machine *m) {
+  uint64_t n = 0;
+  uint8_t fused;
+  int retired;
+
+  while (m->state.cycles < m->run_limit) {
+    fused = m->fused[m->state.pc];
+    if (fused == NOT_DECODED)
+      fused = m->fused[m->state.pc] = decode_fused(m, m->state.pc);
+
+    if (fused != NOT_FUSED) {
+      retired = fuse_fn[fused - 2](m);
+      m->fuse_runs[fused - 2]++;
+      m->fuse_instructions[fused - 2] += retired;
+      n += retired;
+      continue;
+    }
+
+    step_dispatch(m);
+    n++;
+  }
+
+  return n;
+}
@@ -1,351 +1,578 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <unistd.h>
+#include <getopt.h>
 #include "emulator.h"
 
-struct state state;
-uint8_t memory[MEMSIZE];
-
-enum {
-  TYPE_UNKNOWN,
-  TYPE_MOV,
-  TYPE_ALR,
-  TYPE_ALI,
-  TYPE_JUMP,
-  TYPE_PUSH,
-  TYPE_POP,
-  TYPE_RST,
-  TYPE_ROT,
-  TYPE_LXI,
-  TYPE_MVI,
-  TYPE_LDAX,
-  TYPE_STAX,
-  TYPE_INX,
-  TYPE_DCX,
-  TYPE_INR,
-  TYPE_DCR,
-  TYPE_DAD,
-  TYPE_DIR_ADDR
-};
-
-uint8_t get_memory_byte() { // Returns byte pointed to by the H and L registers
-  uint16_t addr = ((uint16_t) state.reg_h << 8) | ((uint16_t) state.reg_l);
-
-  if (addr < 0 || addr >= MEMSIZE) {
-    fprintf(stderr, "ERROR: Invalid memory address: %u\n", addr);
-    exit(-1);
-  }
-
-  return memory[addr];
+uint8_t get_memory_byte(struct machine *m) { // Returns byte pointed to by the H and L registers
+  return read_memory(m, m->state.pairs[HL]);
 }
 
-void set_memory_byte(uint8_t byte) { // Sets byte pointed to by the H and L registers.
-  uint16_t addr = ((uint16_t) state.reg_h << 8) | ((uint16_t) state.reg_l);
-
-  if (addr < 0 || addr >= MEMSIZE) {
-    fprintf(stderr, "ERROR: Invalid memory address: %u\n", addr);
-    exit(-1);
-  }
-
-  memory[addr] = byte;
+void set_memory_byte(struct machine *m, uint8_t byte) { // Sets byte pointed to by the H and L registers.
+  write_memory(m, m->state.pairs[HL], byte);
 }
 
-void push_stack(uint16_t data) {
-  memory[state.sp - 1] = (data & 0xFF00) >> 8; /* High byte */
-  memory[state.sp - 2] = (data & 0xFF); /* Low byte */
-  state.sp -= 2;
+void push_stack(struct machine *m, uint16_t data) {
+  write_memory(m, m->state.sp - 1, (data & 0xFF00) >> 8); /* High byte */
+  write_memory(m, m->state.sp - 2, data & 0xFF); /* Low byte */
+  m->state.sp -= 2;
 }
 
-uint16_t pop_stack() {
-  uint16_t data = (uint16_t) memory[state.sp + 1] << 8 | (uint16_t) memory[state.sp];
-  state.sp += 2;
+uint16_t pop_stack(struct machine *m) {
+  uint16_t data = (uint16_t) read_memory(m, m->state.sp + 1) << 8 | (uint16_t) read_memory(m, m->state.sp);
+  m->state.sp += 2;
   return data;
 }
 
-/* jmp  - 11xxx01x
- * call - 11xxx10x
- * push - 11xx0101
-*/
-
-int get_instr_type(uint8_t opcode) {
-  if ((opcode >= 0x40) && (opcode < 0x80))
-    return TYPE_MOV;
-
-  if ((opcode >= 0x80) && (opcode < 0xC0))
-    return TYPE_ALR;
-
-  if ((opcode & 0xC7) == 0xC6)
-    return TYPE_ALI;
-
-  if ((opcode & 0xCF) == 0xC1)
-    return TYPE_POP;
+void print_machine_state(struct machine *m) {
+  printf("FLAGS: Z=%d\tS=%d\tP=%d\tAC=%d\tCY=%d\n",
+      flag_z(&m->state), flag_s(&m->state), flag_p(&m->state), m->state.flag_ac, m->state.flag_cy);
 
-  if ((opcode & 0xCF) == 0xC5)
-    return TYPE_PUSH;
+  printf("REGIS: B=0x%02x\tC=0x%02x\tD=0x%02x\tE=0x%02x\tH=0x%02x\tL=0x%02x\tA=0x%02x\n",
+      m->state.reg_b, m->state.reg_c, m->state.reg_d, m->state.reg_e, m->state.reg_h, m->state.reg_l, m->state.reg_a);
 
-  if ((opcode & 0xC7) == 0xC7) /* This is the logic for figuring out the instruction format
-                                  1. 11xxx111 == rst instruction format
-                                  2. the xxx portion  is variable and refers to a register, so we mask it out with 0xC7(11000111)
-                                  3. compare against 0xC7 (11000111) */
-    return TYPE_RST;
+  printf("       SP=0x%04x\tPC=0x%04x\n", m->state.sp, m->state.pc);
 
-  if ((opcode & 0xE7) == 0x7)
-    return TYPE_ROT;
+  printf("STACK(0x%04x): [ %02x | %02x | %02x | %02x | %02x | %02x ... ]\n",
+      m->state.sp, read_memory(m, m->state.sp), read_memory(m, m->state.sp + 1), read_memory(m, m->state.sp + 2),
+      read_memory(m, m->state.sp + 3), read_memory(m, m->state.sp + 4), read_memory(m, m->state.sp + 5));
 
-  if ((opcode & 0xCF) == 0x1)
-    return TYPE_LXI;
+  putchar('\n');
+}
 
-  if ((opcode & 0xC7) == 0x6)
-    return TYPE_MVI;
+/* Executes `opcode`, with pc already past it. Decoding is one lookup in
+ * opcode_specs[]; the operand is fetched up front and pc moved past it, so
+ * the cases only deal with what the instruction does. */
+void execute(struct machine *m, uint8_t opcode) {
+  const struct opcode_spec *spec = &opcode_specs[opcode];
+  uint16_t data = 0; /* the operand, if there is one */
 
-  if ((opcode & 0xEF) == 0x2)
-    return TYPE_STAX;
+  m->state.cycles += opcode_cycles[opcode];
 
-  if ((opcode & 0xEF) == 0xa)
-    return TYPE_LDAX;
+  if (spec->operand != OPERAND_NONE)
+    data = read_memory(m, m->state.pc);
+  if (OPERAND_BYTES(spec->operand) == 2)
+    data |= (uint16_t) read_memory(m, m->state.pc + 1) << 8;
+  m->state.pc += OPERAND_BYTES(spec->operand);
 
-  if ((opcode & 0xCF) == 0x3)
-    return TYPE_INX;
+  switch (spec->type) {
+    case TYPE_NOP:
+      break;
 
-  if ((opcode & 0xCF) == 0xb)
-    return TYPE_DCX;
+    case TYPE_HLT:
+      printf("HLT: Exiting program\n");
+      exit(0);
 
-  if ((opcode & 0xC7) == 0x4)
-    return TYPE_INR;
+    case TYPE_EI:
+      m->state.interrupts_enabled = 1;
+      break;
 
-  if ((opcode & 0xC7) == 0x5)
-    return TYPE_DCR;
+    case TYPE_DI:
+      m->state.interrupts_enabled = 0;
+      break;
 
-  if ((opcode & 0xCF) == 0x9)
-    return TYPE_DAD;
+    case TYPE_XCHG:
+      xchg(m);
+      break;
 
-  if ((opcode & 0xE7) == 0x22)
-    return TYPE_DIR_ADDR;
+    case TYPE_XTHL:
+      xthl(m);
+      break;
 
-  if (((opcode >> 6) == 0x3) && (((opcode >> 1) & 0x3) < 3))
-    return TYPE_JUMP;
+    case TYPE_SPHL:
+      set_register_pair(m, SP, get_register_pair(m, HL));
+      break;
 
-  return TYPE_UNKNOWN;
-}
+    case TYPE_PCHL:
+      m->state.pc = m->state.pairs[HL];
+      break;
 
-void print_machine_state() {
-  printf("FLAGS: Z=%d\tS=%d\tP=%d\tAC=%d\tCY=%d\n",
-      state.flag_z, state.flag_s, state.flag_p, state.flag_ac, state.flag_cy);
+    case TYPE_STC:
+      m->state.flag_cy = 1;
+      break;
 
-  printf("REGIS: B=0x%02x\tC=0x%02x\tD=0x%02x\tE=0x%02x\tH=0x%02x\tL=0x%02x\tA=0x%02x\n",
-      state.reg_b, state.reg_c, state.reg_d, state.reg_e, state.reg_h, state.reg_l, state.reg_a);
+    case TYPE_CMC:
+      m->state.flag_cy = !m->state.flag_cy;
+      break;
 
-  printf("       SP=0x%04x\tPC=0x%04x\n", state.sp, state.pc);
+    case TYPE_CMA:
+      m->state.reg_a = ~m->state.reg_a;
+      break;
 
-  printf("STACK(0x%04x): [ %02x | %02x | %02x | %02x | %02x | %02x ... ]\n",
-      state.sp, memory[state.sp], memory[state.sp + 1], memory[state.sp + 2],
-      memory[state.sp + 3], memory[state.sp + 4], memory[state.sp + 5]);
+    case TYPE_DAA:
+      daa(m);
+      break;
 
-  putchar('\n');
-}
+    case TYPE_IN:
+      m->state.reg_a = m->state.input_pins[data];
+      break;
 
-void execute(uint8_t opcode) {
-  int instr_type;
+    case TYPE_OUT:
+      device_out(m, data, m->state.reg_a);
+      break;
 
-  switch (opcode) {
-    case 0x00: // NOP
+    case TYPE_LDAX:
+      m->state.reg_a = read_memory(m, get_register_pair(m, (opcode >> 4) & 0x1));
       break;
 
-    case 0x76: // HLT
-      printf("HLT: Exiting program\n");
-      exit(0);
+    case TYPE_STAX:
+      write_memory(m, get_register_pair(m, (opcode >> 4) & 0x1), m->state.reg_a);
+      break;
 
-    case 0xFB: // EI
-      state.interrupts_enabled = 1;
+    case TYPE_INX:
+      set_register_pair(m, (opcode >> 4) & 0x3, get_register_pair(m, (opcode >> 4) & 0x3) + 1);
       break;
 
-    case 0xF3: // DI
-      state.interrupts_enabled = 0;
+    case TYPE_DCX:
+      set_register_pair(m, (opcode >> 4) & 0x3, get_register_pair(m, (opcode >> 4) & 0x3) - 1);
       break;
 
-    case 0xEB: // XCHNG
-      xchg();
+    case TYPE_INR:
+      increment(m, (opcode >> 3) & 0x7);
       break;
 
-    case 0xE3: // XTHL
-      xthl();
+    case TYPE_DCR:
+      decrement(m, (opcode >> 3) & 0x7);
       break;
 
-    case 0xF9: // SPHL
-      set_register_pair(SP, get_register_pair(HL));
+    case TYPE_ALR:
+      arithmetic_logic(m, (opcode >> 3) & 0x7, get_register_content(m, opcode & 0x7));
       break;
 
-    case 0xE9: // PCHL
-      state.pc = ((uint16_t) state.reg_h << 8) | ((uint16_t) state.reg_l);
+    case TYPE_ALI:
+      arithmetic_logic(m, (opcode >> 3) & 0x7, data);
       break;
 
-    case 0x37: // STC
-      state.flag_cy = 1;
+    case TYPE_DAD:
+      dad(m, (opcode >> 4) & 0x3);
       break;
 
-    case 0x3F: // CMC
-      state.flag_cy = !state.flag_cy;
+    case TYPE_MOV:
+      set_register_content(m, (opcode >> 3) & 0x7, /* dst */
+                           get_register_content(m, opcode & 0x7) /* src */
+      );
       break;
 
-    case 0x2F: // CMA
-      state.reg_a = ~state.reg_a;
+    case TYPE_MVI:
+      set_register_content(m, (opcode >> 3) & 0x7, data);
       break;
 
-    case 0xDB: // IN
-      state.reg_a = state.input_pins[memory[state.pc]];
-      state.pc+= 1;
+    case TYPE_LXI:
+      set_register_pair(m, (opcode >> 4) & 0x3, data);
       break;
 
-    case 0xD3: // OUT
-      device_out(memory[state.pc], state.reg_a);
-      state.pc+= 1;
+    case TYPE_JUMP:
+      jump(m, (opcode >> 3) & 0x7, /* condition to check against */
+           (opcode >> 1) & 0x3, /* jmp, call, or ret */
+           data, /* address to jump to */
+           opcode & 0x1 /* Special flag for deciding jmp vs. jnz, call vs. cz, ret vs. rz */
+      );
       break;
 
-    default:
-      instr_type = get_instr_type(opcode);
+    case TYPE_DIR_ADDR:
+      direct_address(m, (opcode >> 3) & 0x3, data);
+      break;
 
-      switch (instr_type) {
-        case TYPE_LDAX:
-          state.reg_a = memory[get_register_pair((opcode >> 4) & 0x1)];
-          break;
+    case TYPE_RST:
+      reset(m, (opcode >> 3) & 0x7);
+      break;
 
-        case TYPE_STAX:
-          memory[get_register_pair((opcode >> 4) & 0x1)] = state.reg_a;
-          break;
+    case TYPE_POP:
+      pop(m, (opcode >> 4) & 0x3);
+      break;
 
-        case TYPE_INX:
-          set_register_pair((opcode >> 4) & 0x3, get_register_pair((opcode >> 4) & 0x3) + 1);
-          break;
+    case TYPE_PUSH:
+      push(m, (opcode >> 4) & 0x3);
+      break;
 
-        case TYPE_DCX:
-          set_register_pair((opcode >> 4) & 0x3, get_register_pair((opcode >> 4) & 0x3) - 1);
-          break;
+    case TYPE_ROT:
+      rotate(m, (opcode >> 3) & 0x3);
+      break;
 
-        case TYPE_INR:
-          increment((opcode >> 3) & 0x7);
-          break;
+    case TYPE_UNKNOWN:
+      die_error("Unsupported opcode: %x\n", opcode);
+      exit(-1);
+  }
+}
 
-        case TYPE_DCR:
-          decrement((opcode >> 3) & 0x7);
-          break;
+void step_switch(struct machine *m) {
+  PROFILE_BEGIN(m);
+  uint8_t opcode = read_memory(m, m->state.pc);
+  m->state.pc += 1;
+  execute(m, opcode);
+  PROFILE_END(m);
+}
 
-        case TYPE_ALR:
-          arithmetic_logic((opcode >> 3) & 0x7, get_register_content(opcode & 0x7));
-          break;
+/* The switch core's batch loop, see run_until() */
+uint64_t run_switch(struct machine *m) {
+  uint64_t n = 0;
 
-        case TYPE_ALI:
-          arithmetic_logic((opcode >> 3) & 0x7, memory[state.pc]);
-          state.pc++;
-          break;
+  while (m->state.cycles < m->run_limit) {
+    step_switch(m);
+    n++;
+  }
 
-        case TYPE_DAD:
-          dad((opcode >> 4) & 0x3);
-          break;
+  return n;
+}
 
-        case TYPE_MOV:
-          set_register_content((opcode >> 3) & 0x7, /* dst */
-                               get_register_content(opcode & 0x7) /* src */
-          );
-          break;
+void interrupt(struct machine *m, uint8_t opcode) {
+  if (m->state.interrupts_enabled) {
+    m->state.interrupts_enabled = 0;
+    execute(m, opcode);
+  }
+}
 
-        case TYPE_MVI:
-          set_register_content((opcode >> 3) & 0x7, /* Register identifier */
-                               memory[state.pc]); /* immediate data */
-          state.pc++;
-          break;
+/* Raises the screen interrupt once the cycle counter reaches it. Returns the
+ * half of the screen the beam has just finished, or -1 if none is due. */
+int screen_interrupt(struct machine *m) {
+  int half;
 
-        case TYPE_LXI:
-          set_register_pair((opcode >> 4) & 0x3, /* Register pair identifier */
-                            ((uint16_t) memory[state.pc + 1] << 8) | ((uint16_t) memory[state.pc]) /* immediate data */
-          );
-          state.pc += 2;
-          break;
+  if (m->state.cycles < m->state.next_interrupt)
+    return -1;
 
-        case TYPE_JUMP:
-          jump((opcode >> 3) & 0x7, /* condition to check against */
-               (opcode >> 1) & 0x3, /* jmp, call, or ret */
-               ((uint16_t) memory[state.pc + 1] << 8) | ((uint16_t) memory[state.pc]), /* address to jump to */
-               opcode & 0x1 /* Special flag for deciding jmp vs. jnz, call vs. cz, ret vs. rz */
-          );
-          break;
+  half = m->state.screen_half;
+  interrupt(m, half == MIDDLE ? 0xcf : 0xd7); /* RST 1 : RST 2 */
 
-        case TYPE_DIR_ADDR:
-          direct_address((opcode >> 3) & 0x3, /* which op? */
-                       ((uint16_t) memory[state.pc + 1] << 8) | ((uint16_t) memory[state.pc]) /* direct address*/
-          );
-          state.pc += 2;
-          break;
+  m->state.next_interrupt += HALF_FRAME_CYCLES;
+  m->state.screen_half = !half;
 
-        case TYPE_RST:
-          reset((opcode >> 3) & 0x7);
-          break;
+  /* vblank is the frame boundary: input is latched and history captured */
+  if (half == BOTTOM) {
+    if (m->movie)
+      movie_frame(m);
+    if (m->rewind)
+      rewind_capture(m);
+  }
 
-        case TYPE_POP:
-          pop((opcode >> 4) & 0x3);
-          break;
-
-        case TYPE_PUSH:
-          push((opcode >> 4) & 0x3);
-          break;
-
-        case TYPE_ROT:
-          rotate((opcode >> 3) & 0x3);
-          break;
-
-        case TYPE_UNKNOWN:
-          die_error("Unsupported opcode: %x\n", opcode);
-          exit(-1);
-      }
-   }
+  return half;
 }
 
-void interrupt(uint8_t opcode) {
-  if (state.interrupts_enabled) {
-    state.interrupts_enabled = 0;
-    execute(opcode);
+void device_out(struct machine *m, int dev, uint8_t byte) {
+  if (m->out_ports[dev >> 6] & ((uint64_t) 1 << (dev & 63))) {
+    m->out_port = dev;
+    m->out_byte = byte;
+    end_batch(m, RUN_OUT);
+  }
+
+  if (m->cpm) {
+    cpm_out(m, dev);
+    return;
   }
-}
 
-void device_out(int dev, uint8_t byte) {
   switch(dev) {
     case 2:
     case 4:
-      shift_hardware(dev, byte);
+      shift_hardware(m, dev, byte);
+      break;
+    case 3:
+    case 5:
+      if (m->audio)
+        audio_out(m, dev, byte);
       break;
   }
 }
 
-int main(int argc, char **argv) {
-  if (argc < 2) {
-    printf("Usage: %s PATH\n", argv[0]);
-    return 0;
-  }
+struct machine *create_machine() {
+  struct machine *m = calloc(1, sizeof(struct machine));
+
+  if (m == NULL)
+    die_error("Could not allocate machine\n");
+
+  m->state.interrupts_enabled = 1;
+  m->state.next_interrupt = HALF_FRAME_CYCLES;
+  m->state.flag_zsp = 0x01; /* Z, S and P clear */
+  m->idle_skip = 1;
+  bus_map_invaders(m);
+  return m;
+}
+
+void free_machine(struct machine *m) {
+  jit_free(m);
+  rewind_free(m);
+  movie_free(m);
+  audio_free(m);
+  free(m->frontend);
+  free(m);
+}
+
+void load_rom(struct machine *m, char *path) {
+  FILE *fp = fopen(path, "r");
 
-  initialize_sdl();
-  state.interrupts_enabled = 1;
+  if (fp == NULL)
+    die_error("Could not open ROM: %s\n", path);
 
-  FILE *fp = fopen(argv[1], "r");
-  fread(memory, 8192, 1, fp); /* Load ROM */
+  fread(m->memory, 8192, 1, fp);
   fclose(fp);
+}
 
-  uint8_t opcode;
-  int count = 0;
+/* The windowed CPU loop. run_frontend() runs it on a thread of its own. */
+void emulate(struct machine *m, int core) {
+  do
+    run_until(m, core, m->state.next_interrupt);
+  while (display(m));
+}
 
-  while (1) {
-    //disassemble8080(memory, state.pc);
+/* Loads the ROM, or a benchmark kernel, CP/M program or save state in its place */
+static void start_machine(struct machine *m, char *state_path, char *kernel, int cpm, char *rom_path, int verbose) {
+  double us;
 
-    opcode = memory[state.pc];
-    state.pc += 1;
-    count += 1;
+  if (cpm) {
+    load_com(m, rom_path);
+    return;
+  }
 
-    execute(opcode);
-    display();
-    input();
+  if (kernel) {
+    load_kernel(m, kernel);
+    return;
+  }
 
-    //print_machine_state();
-    // usleep(10000);
+  if (!state_path) {
+    load_rom(m, rom_path);
+    return;
   }
 
+  us = load_state(m, state_path);
+  if (verbose)
+    printf("state restored in %.1f us\n", us);
+}
+
+static void start_movie(struct machine *m, char *record_path, char *replay_path) {
+  if (record_path)
+    movie_record(m, record_path);
+  if (replay_path)
+    movie_replay(m, replay_path);
+}
+
+static void usage(char *prog) {
+  printf("Usage: %s [--core=switch|dispatch|jit] [--overlay] [--speed=N|unlimited] [--frameskip=N]\n"
+         "       [--headless [--frames=N] [--cycles=N]\n"
+         "       [--instances=N [--threads=N]] [--bench-video] [--bench-alu] [--rewind-by=N]\n"
+         "       [--save-state=FILE] [--csv]] [--load-state=FILE | --kernel=alu|memory|branch|call]\n"
+         "       [--rewind=MB] [--record=FILE | --replay=FILE] [--samples=DIR] [--audio-buffer=N]\n"
+         "       [--cpm] [--no-idle] PATH\n"
+         "PATH may be omitted with --load-state or --kernel. With --cpm, PATH is a CP/M\n"
+         ".COM program run headless until it exits.\n", prog);
+}
+
+int main(int argc, char **argv) {
+  static struct option long_options[] = {
+    {"core", required_argument, NULL, 'c'},
+    {"headless", no_argument, NULL, 'H'},
+    {"frames", required_argument, NULL, 'f'},
+    {"cycles", required_argument, NULL, 'n'},
+    {"instances", required_argument, NULL, 'i'},
+    {"threads", required_argument, NULL, 't'},
+    {"overlay", no_argument, NULL, 'o'},
+    {"bench-video", no_argument, NULL, 'V'},
+    {"bench-alu", no_argument, NULL, 'A'},
+    {"save-state", required_argument, NULL, 's'},
+    {"load-state", required_argument, NULL, 'l'},
+    {"rewind", required_argument, NULL, 'r'},
+    {"rewind-by", required_argument, NULL, 'R'},
+    {"record", required_argument, NULL, 'm'},
+    {"replay", required_argument, NULL, 'p'},
+    {"speed", required_argument, NULL, 'S'},
+    {"frameskip", required_argument, NULL, 'k'},
+    {"kernel", required_argument, NULL, 'K'},
+    {"csv", no_argument, NULL, 'C'},
+    {"cpm", no_argument, NULL, 'P'},
+    {"samples", required_argument, NULL, 'w'},
+    {"audio-buffer", required_argument, NULL, 'b'},
+    {"no-idle", no_argument, NULL, 'I'},
+    {NULL, 0, NULL, 0}
+  };
+  int core = CORE_SWITCH, headless = 0, instances = 0, threads = 0, overlay = 0, video = 0, alu = 0;
+  uint64_t frames = 0, cycles = 0;
+  char *save_path = NULL, *load_path = NULL;
+  int rewind_mb = 0, rewind_by = 0;
+  char *record_path = NULL, *replay_path = NULL;
+  int speed = 1, frameskip = 1;
+  char *kernel = NULL;
+  int csv = 0, cpm = 0;
+  char *sample_dir = NULL;
+  int audio_buffer = 512;
+  int idle = 1;
+  struct run_stats stats;
+  struct machine *m;
+  int c;
+
+  while ((c = getopt_long(argc, argv, "c:Hf:n:i:t:oVAs:l:r:R:m:p:S:k:K:CPw:b:I", long_options, NULL)) != -1) {
+    switch (c) {
+      case 'c':
+        if (strcmp(optarg, "switch") == 0)
+          core = CORE_SWITCH;
+        else if (strcmp(optarg, "dispatch") == 0)
+          core = CORE_DISPATCH;
+        else if (strcmp(optarg, "jit") == 0)
+          core = CORE_JIT;
+        else {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'H':
+        headless = 1;
+        break;
+      case 'f':
+        frames = strtoull(optarg, NULL, 10);
+        break;
+      case 'n':
+        cycles = strtoull(optarg, NULL, 10);
+        break;
+      case 'i':
+        instances = atoi(optarg);
+        break;
+      case 't':
+        threads = atoi(optarg);
+        break;
+      case 'o':
+        overlay = 1;
+        break;
+      case 'V':
+        video = 1;
+        break;
+      case 'A':
+        alu = 1;
+        break;
+      case 's':
+        save_path = optarg;
+        break;
+      case 'l':
+        load_path = optarg;
+        break;
+      case 'r':
+        rewind_mb = atoi(optarg);
+        break;
+      case 'R':
+        rewind_by = atoi(optarg);
+        break;
+      case 'm':
+        record_path = optarg;
+        break;
+      case 'p':
+        replay_path = optarg;
+        break;
+      case 'S':
+        speed = (strcmp(optarg, "unlimited") == 0) ? 0 : atoi(optarg);
+        if (speed < 0) {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'k':
+        frameskip = atoi(optarg);
+        break;
+      case 'K':
+        kernel = optarg;
+        break;
+      case 'C':
+        csv = 1;
+        break;
+      case 'P':
+        cpm = 1;
+        headless = 1; /* console output only */
+        break;
+      case 'w':
+        sample_dir = optarg;
+        break;
+      case 'b':
+        audio_buffer = atoi(optarg);
+        if (audio_buffer < 16 || audio_buffer > 8192) {
+          usage(argv[0]);
+          return 1;
+        }
+        break;
+      case 'I':
+        idle = 0;
+        break;
+      default:
+        usage(argv[0]);
+        return 1;
+    }
+  }
+
+  if (optind >= argc && ((!load_path && !kernel) || cpm)) {
+    usage(argv[0]);
+    return 0;
+  }
+
+  m = create_machine();
+  m->idle_skip = idle;
+
+  if (core != CORE_SWITCH)
+    init_dispatch(); /* the JIT calls into the dispatch handlers */
+
+  if (core == CORE_JIT && instances == 0)
+    jit_init(m);
+
+  if ((record_path || replay_path) && instances > 0)
+    die_error("--record and --replay cannot be used with --instances\n");
+
+  if (headless) {
+    start_machine(m, load_path, kernel, cpm, argv[optind], !csv);
+    start_movie(m, record_path, replay_path);
+
+    if (!frames && !cycles && !cpm) /* CP/M programs run until they exit */
+      frames = movie_length(m) ? movie_length(m) : 60;
+
+    if (rewind_by && !rewind_mb)
+      rewind_mb = 4;
+    if (rewind_mb && instances == 0)
+      rewind_init(m, (size_t) rewind_mb << 20);
+
+    if (instances > 0) {
+      run_pool(m, core, instances, threads, frames, cycles, &stats);
+      if (!csv)
+        printf("instances:    %d\n", instances);
+    } else
+      run_headless(m, core, frames, cycles, &stats);
+
+    if (cpm)
+      printf("\n"); /* programs rarely end their last line */
+
+    if (csv)
+      print_run_stats_csv(&stats);
+    else
+      print_run_stats(&stats);
+
+    if (core == CORE_DISPATCH && instances == 0 && !csv)
+      print_fuse_stats(m);
+
+    if (video)
+      bench_video(m, 2000); /* converts whatever is on screen after the run */
+
+    if (alu)
+      bench_alu(m, 20000000);
+
+    if (m->rewind) {
+      print_rewind_stats(m);
+      if (rewind_by)
+        printf("rewound:      %d frames\n", rewind_frames(m, rewind_by));
+    }
+
+    if (save_path)
+      save_state(m, save_path);
+#ifdef FLAG_STATS
+    print_flag_stats(m);
+#endif
+#ifdef PROFILE
+    print_profile(m, 20);
+#endif
+    free_machine(m);
+    return 0;
+  }
+
+  initialize_sdl(m, overlay);
+  set_speed(m, speed, frameskip);
+  audio_init(m, sample_dir, audio_buffer);
+  start_machine(m, load_path, kernel, cpm, argv[optind], 0);
+  start_movie(m, record_path, replay_path);
+
+  if (rewind_mb)
+    rewind_init(m, (size_t) rewind_mb << 20);
+
+  run_frontend(m, core);
   return 0;
 }
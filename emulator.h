@@ -1,6 +1,7 @@
 #ifndef EMULATOR_H
 #define EMULATOR_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define MEMSIZE 65536
@@ -20,84 +21,460 @@
 #define SP 3
 #define FA 4
 
-/* Our global machine state */
+#define CORE_SWITCH 0
+#define CORE_DISPATCH 1
+#define CORE_JIT 2
+
+#define CLOCK_HZ 2000000
+#define HALF_FRAME_CYCLES 16666 /* 2 MHz / 120 Hz */
+#define COND_TAKEN_CYCLES 6 /* extra cycles for a taken conditional CALL/RET */
+
+#define SCREEN_WIDTH 224 /* as seen on the rotated monitor */
+#define SCREEN_HEIGHT 256
+
+#define VRAM_START 0x2400
+#define VRAM_SIZE 0x1C00 /* 256x224 pixels, one bit each */
+
+#define MIDDLE 0 /* RST 1 fires when the beam reaches the middle of the screen */
+#define BOTTOM 1 /* RST 2 fires at vblank */
+
+/* Registers live in an array indexed by their 3-bit encoding, through
+ * REG_INDEX(), which also swaps bytes so that each pair reads as a host-endian
+ * uint16_t: BC, DE and HL, plus A over the flag byte in the M slot (PSW). */
+#define HOST_LITTLE_ENDIAN (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define REG_INDEX(reg) ((reg) ^ (((reg) < MEM_REF) == HOST_LITTLE_ENDIAN))
+#define PSW 3 /* index of A and the flag byte in pairs[] */
+
+/* CPU state */
 struct state {
-  uint8_t reg_b;
-  uint8_t reg_c;
-  uint8_t reg_d;
-  uint8_t reg_e;
-  uint8_t reg_h;
-  uint8_t reg_l;
-  uint8_t reg_a;
+  union {
+    uint8_t regs[8]; /* [REG_INDEX(REG_B)] and so on */
+    uint16_t pairs[4]; /* [BC], [DE], [HL] and [PSW] */
+    struct { /* the same by name */
+#if HOST_LITTLE_ENDIAN
+      uint8_t reg_c, reg_b, reg_e, reg_d, reg_l, reg_h, reg_f, reg_a;
+#else
+      uint8_t reg_b, reg_c, reg_d, reg_e, reg_h, reg_l, reg_a, reg_f;
+#endif
+    };
+  };
 
   uint16_t sp; /* stack pointer */
   uint16_t pc; /* program counter */
 
-  uint8_t flag_z; /* zero flag */
-  uint8_t flag_s; /* sign flag */
-  uint8_t flag_p; /* parity flag */
+  /* The flags are kept apart and evaluated lazily; reg_f only holds them
+   * packed while PUSH and POP PSW move them */
+  uint16_t flag_zsp; /* last result that set Z, S and P -- see flag_z() */
   uint8_t flag_cy; /* carry flag */
   uint8_t flag_ac; /* auxillary carry flag */
 
   uint8_t interrupts_enabled;
 
+  uint64_t cycles; /* emulated clock cycles since reset */
+  uint64_t next_interrupt; /* cycle count at which the next screen interrupt fires */
+  uint8_t screen_half; /* MIDDLE or BOTTOM -- which interrupt is next */
+
   uint8_t input_pins[256];
 };
 
-extern struct state state;
-extern uint8_t memory[MEMSIZE];
+#ifdef PROFILE
+/* Execution counts, see profile.c */
+struct profile {
+  uint64_t total; /* instructions recorded */
+  uint64_t op_count[256];
+  uint64_t op_cycles[256];
+  uint64_t pc_count[MEMSIZE];
+  uint64_t pc_cycles[MEMSIZE];
+  uint64_t pairs[256][256]; /* [previous opcode][opcode] */
+  uint8_t last_op;
+};
+#endif
+
+/* Emulates the hardware shift register used by Space Invaders */
+struct shifter {
+  uint16_t shift_register;
+  int shift_amount;
+};
+
+/* Memory bus: the 64K address space as 256 pages of 256 bytes */
+#define BUS_PAGES 256
+
+#define PAGE_RAM 0x01
+#define PAGE_ROM 0x02 /* stores are dropped */
+
+/* Reasons to see stores to a page of memory[] */
+#define WATCH_VRAM 0x01 /* mark changed bytes in vram_dirty */
+#define WATCH_CODE 0x02 /* the page holds translated code, check code_bytes */
+#define WATCH_DIRTY 0x04 /* mark the page in page_dirty, then stop watching */
+
+struct bus {
+  uint8_t *read[BUS_PAGES]; /* host address of each guest page for loads */
+  uint8_t *write[BUS_PAGES]; /* the same for stores, NULL if they need bus_write() */
+  uint8_t flags[BUS_PAGES]; /* PAGE_* */
+  uint8_t phys[BUS_PAGES]; /* page of memory[] behind each guest page */
+  uint8_t watch[BUS_PAGES]; /* WATCH_* of each page of memory[] */
+};
+
+/* Superinstructions: short sequences the dispatch core runs as one handler */
+#define FUSE_DCR_JNZ 0 /* DCR r; JNZ -- counted loops */
+#define FUSE_TEST_JCC 1 /* ANA A or ORA A; JZ or JNZ */
+#define FUSE_LDA_DCR_JNZ 2 /* LDA; DCR A; JNZ -- polling a counter */
+#define FUSE_LDA_TEST_JCC 3 /* LDA; ANA A or ORA A; JZ or JNZ -- polling a flag */
+#define FUSE_LXI_H_STORE 4 /* LXI H; MOV M,r or MVI M */
+#define FUSE_COPY 5 /* LDAX D; MOV M,A, then INX H and INX D in either order if present */
+#define FUSE_KINDS 6
+
+struct frontend; /* SDL window and surfaces, see hardware.c */
+struct jit; /* translation cache, see jit.c */
+struct rewind; /* frame history, see rewind.c */
+struct movie; /* input recording or replay, see movie.c */
+struct audio; /* sound mixer, see audio.c */
+
+/* Everything one emulated machine owns. Nothing in the core touches global
+ * state, so independent machines can run on separate threads. */
+struct machine {
+  struct state state;
+  uint8_t memory[MEMSIZE];
+  struct shifter shifter;
+  struct frontend *frontend; /* NULL when running headless */
+
+  struct bus bus;
+
+  struct jit *jit; /* NULL unless the JIT core is in use */
+  uint8_t code_dirty; /* set when a store hits translated code */
+  uint64_t code_bytes[MEMSIZE / 64]; /* bytes of memory[] holding translated code */
+  uint64_t code_dirty_bytes[MEMSIZE / 64]; /* those of them stored to since */
+  uint64_t vram_dirty[VRAM_SIZE / 64]; /* one bit per VRAM byte changed since it was last drawn */
+
+  struct rewind *rewind; /* NULL unless rewind history is being kept */
+  uint64_t page_dirty[BUS_PAGES / 64]; /* pages of memory[] changed since the last vblank */
+
+  struct movie *movie; /* NULL unless recording or replaying input */
+  struct audio *audio; /* NULL when running without sound */
+
+  uint8_t cpm; /* running a CP/M program instead of the arcade board, see cpm.c */
+  uint8_t stopped; /* set when the program asks to exit; headless runs end there */
+
+  /* Batch execution, see run.c */
+  uint64_t instructions; /* retired since reset */
+  uint64_t run_limit; /* the running batch ends when cycles reach this */
+  int run_event; /* what run_until() will report, RUN_* */
+  uint64_t out_ports[4]; /* ports whose OUT ends a batch */
+  uint8_t out_port; /* the OUT that ended the last batch */
+  uint8_t out_byte;
+  uint64_t breakpoints[MEMSIZE / 64];
+  int breakpoint_count;
+  uint8_t idle_skip; /* fast-forward through idle loops */
+  uint64_t idle_cycles; /* skipped that way since reset */
+
+  /* Superinstructions, see dispatch.c */
+  uint8_t fused[MEMSIZE]; /* what starts at each address: not decoded yet, nothing, or FUSE_* */
+  uint64_t fuse_runs[FUSE_KINDS]; /* times each sequence ran */
+  uint64_t fuse_instructions[FUSE_KINDS]; /* instructions retired by them */
+
+#ifdef PROFILE
+  struct profile profile;
+#endif
+
+#ifdef FLAG_STATS
+  uint64_t flag_updates; /* results recorded by ALU/INR/DCR */
+  uint64_t flag_reads; /* times Z or S were materialized */
+  uint64_t parity_reads; /* times P was materialized */
+#endif
+};
+
+#ifdef FLAG_STATS
+#define FLAG_STAT(m, counter) ((m)->counter++)
+#else
+#define FLAG_STAT(m, counter) ((void) 0)
+#endif
+
+void bus_write(struct machine *m, uint16_t addr, uint8_t byte);
+
+/* Wrap one interpreted instruction */
+#ifdef PROFILE
+#define PROFILE_BEGIN(m) \
+  uint16_t profile_pc = (m)->state.pc; \
+  uint8_t profile_op = read_memory((m), profile_pc); \
+  uint64_t profile_cycles = (m)->state.cycles
+#define PROFILE_END(m) profile_record((m), profile_pc, profile_op, (m)->state.cycles - profile_cycles)
+#else
+#define PROFILE_BEGIN(m) ((void) 0)
+#define PROFILE_END(m) ((void) 0)
+#endif
+
+/* Lazy flags: the low byte of flag_zsp is the last ALU/INR/DCR result. POP PSW
+ * can load combinations no result byte produces, so bit 8 forces S and bit 9
+ * inverts P. */
+#define ZSP_FORCE_S 0x100
+#define ZSP_FLIP_P 0x200
+
+extern const uint8_t parity_table[256];
+
+static inline int flag_z(const struct state *s) {
+  return (s->flag_zsp & 0xFF) == 0;
+}
+
+static inline int flag_s(const struct state *s) {
+  return (s->flag_zsp & (0x80 | ZSP_FORCE_S)) != 0;
+}
+
+static inline int flag_p(const struct state *s) {
+  return parity_table[s->flag_zsp & 0xFF] ^ ((s->flag_zsp >> 9) & 1);
+}
+
+/* Every guest load goes through the bus page table: one lookup, no branches */
+static inline uint8_t read_memory(struct machine *m, uint16_t addr) {
+  return m->bus.read[addr >> 8][addr & 0xFF];
+}
+
+/* Every guest store too. Plain RAM is stored straight away; ROM and
+ * watched pages (VRAM, translated code, rewind tracking) have no write
+ * pointer and go through bus_write(). */
+static inline void write_memory(struct machine *m, uint16_t addr, uint8_t byte) {
+  uint8_t *page = m->bus.write[addr >> 8];
+
+  if (page) {
+    page[addr & 0xFF] = byte;
+    return;
+  }
+
+  bus_write(m, addr, byte);
+}
+
+struct machine *create_machine();
+void free_machine(struct machine *m);
+void interrupt(struct machine *m, uint8_t opcode);
+int screen_interrupt(struct machine *m);
+void execute(struct machine *m, uint8_t opcode);
+void step_switch(struct machine *m);
+uint64_t run_switch(struct machine *m);
+void emulate(struct machine *m, int core);
+void load_rom(struct machine *m, char *path);
+
+/* opcodes */
+enum { /* how execute() decodes an opcode */
+  TYPE_UNKNOWN,
+  TYPE_MOV,
+  TYPE_ALR,
+  TYPE_ALI,
+  TYPE_JUMP,
+  TYPE_PUSH,
+  TYPE_POP,
+  TYPE_RST,
+  TYPE_ROT,
+  TYPE_LXI,
+  TYPE_MVI,
+  TYPE_LDAX,
+  TYPE_STAX,
+  TYPE_INX,
+  TYPE_DCX,
+  TYPE_INR,
+  TYPE_DCR,
+  TYPE_DAD,
+  TYPE_DIR_ADDR,
+  TYPE_NOP,
+  TYPE_HLT,
+  TYPE_EI,
+  TYPE_DI,
+  TYPE_XCHG,
+  TYPE_XTHL,
+  TYPE_SPHL,
+  TYPE_PCHL,
+  TYPE_STC,
+  TYPE_CMC,
+  TYPE_CMA,
+  TYPE_DAA,
+  TYPE_IN,
+  TYPE_OUT
+};
+
+/* What follows the opcode */
+#define OPERAND_NONE 0
+#define OPERAND_D8 1 /* immediate byte */
+#define OPERAND_PORT 2 /* I/O port */
+#define OPERAND_D16 3 /* immediate word */
+#define OPERAND_ADDR 4 /* memory or jump address */
+#define OPERAND_BYTES(operand) ((operand) >= OPERAND_D16 ? 2 : (operand) != OPERAND_NONE)
+
+/* Flags an instruction can change */
+#define SETS_Z 0x01
+#define SETS_S 0x02
+#define SETS_P 0x04
+#define SETS_CY 0x08
+#define SETS_AC 0x10
+#define SETS_ALL (SETS_Z | SETS_S | SETS_P | SETS_CY | SETS_AC)
 
-void interrupt(uint8_t opcode);
+struct opcode_spec {
+  uint8_t type; /* TYPE_* */
+  uint8_t operand; /* OPERAND_* */
+  uint8_t flags; /* SETS_* */
+  const char *mnemonic;
+  const char *registers; /* register operands as written, "" if none */
+};
+
+extern const struct opcode_spec opcode_specs[256];
+extern const uint8_t opcode_cycles[256];
+extern const uint8_t opcode_length[256]; /* in bytes, opcode included */
 
 /* register */
-uint8_t get_register_content(int reg_num);
-void set_register_content(int reg_num, uint8_t byte);
-uint16_t get_register_pair(int regpair);
-void set_register_pair(int regpair, uint16_t data);
-int get_cond(int cond, int op, int condflg);
+uint8_t get_register_content(struct machine *m, int reg_num);
+void set_register_content(struct machine *m, int reg_num, uint8_t byte);
+uint16_t get_register_pair(struct machine *m, int regpair);
+void set_register_pair(struct machine *m, int regpair, uint16_t data);
+int get_cond(struct machine *m, int cond, int op, int condflg);
 
 /* memory */
-uint8_t get_memory_byte();
-void set_memory_byte(uint8_t byte);
-void push_stack(uint16_t data);
-uint16_t pop_stack();
+uint8_t get_memory_byte(struct machine *m);
+void set_memory_byte(struct machine *m, uint8_t byte);
+void push_stack(struct machine *m, uint16_t data);
+uint16_t pop_stack(struct machine *m);
 
 /* utility */
-uint8_t get_flagbyte();
-void restore_flags(uint8_t flagbyte);
+uint8_t get_flagbyte(struct machine *m);
+void restore_flags(struct machine *m, uint8_t flagbyte);
 int check_parity(uint8_t byte);
+#ifdef FLAG_STATS
+void print_flag_stats(struct machine *m);
+#endif
+
+/* dispatch */
+struct op {
+  void (*fn)(struct machine *m, const struct op *op); /* handler for this opcode */
+  uint8_t a; /* first decoded operand (register offset, pair, ALU op or condition) */
+  uint8_t b; /* second decoded operand */
+};
+
+extern struct op dispatch_table[256];
+
+void init_dispatch();
+void step_dispatch(struct machine *m);
+uint64_t run_dispatch(struct machine *m);
+void flush_fused(struct machine *m);
+void print_fuse_stats(struct machine *m);
+
+/* run */
+#define RUN_BUDGET 0 /* the cycle count asked for was reached */
+#define RUN_INTERRUPT 1 /* a screen interrupt is due */
+#define RUN_OUT 2 /* OUT to a port registered with watch_port() */
+#define RUN_BREAK 3 /* the next instruction is at a breakpoint */
+#define RUN_STOP 4 /* the program stopped the machine */
+
+int run_until(struct machine *m, int core, uint64_t cycle);
+int run_cycles(struct machine *m, int core, uint64_t cycles);
+void end_batch(struct machine *m, int event);
+void set_breakpoint(struct machine *m, uint16_t addr, int on);
+void watch_port(struct machine *m, uint8_t port, int on);
+
+/* jit */
+void jit_init(struct machine *m);
+void jit_free(struct machine *m);
+uint64_t jit_run(struct machine *m);
+void jit_flush(struct machine *m);
+
+/* headless */
+struct run_stats {
+  uint64_t instructions;
+  uint64_t cycles;
+  uint64_t frames;
+  uint64_t idle_cycles; /* of `cycles`, skipped in idle loops */
+  double seconds; /* wall time */
+};
+
+void run_headless(struct machine *m, int core, uint64_t frames, uint64_t cycles, struct run_stats *stats);
+#define RUN_STATS_CSV_HEADER "instructions,cycles,frames,seconds,mips,emulated_mhz,ns_per_frame,peak_rss_kb,idle_cycles"
+
+void print_run_stats(const struct run_stats *stats);
+void print_run_stats_csv(const struct run_stats *stats);
+
+/* pool */
+void run_pool(struct machine *template, int core, int instances, int threads, uint64_t frames, uint64_t cycles,
+              struct run_stats *total);
+
+/* video */
+struct renderer {
+  uint32_t color[SCREEN_HEIGHT][SCREEN_WIDTH / 8]; /* lit color of each 8-pixel run, overlay included */
+  void (*tile)(const struct renderer *r, uint32_t *pixels, int stride, int group, int row, uint64_t bits);
+};
+
+void init_renderer(struct renderer *r, uint32_t white, uint32_t red, uint32_t green, int overlay);
+int render_half(struct machine *m, const struct renderer *r, int half, uint32_t *pixels, int stride);
+void bench_video(struct machine *m, int iterations);
+
+/* savestate */
+void save_state(struct machine *m, char *path);
+double load_state(struct machine *m, char *path);
+
+/* rewind */
+void rewind_init(struct machine *m, size_t bytes);
+void rewind_free(struct machine *m);
+void rewind_capture(struct machine *m);
+int rewind_frames(struct machine *m, int frames);
+void print_rewind_stats(struct machine *m);
+
+/* movie */
+void movie_record(struct machine *m, char *path);
+void movie_replay(struct machine *m, char *path);
+void movie_free(struct machine *m);
+uint64_t movie_length(struct machine *m);
+void set_input_port(struct machine *m, int port, uint8_t value);
+void movie_frame(struct machine *m);
+
+/* audio */
+void audio_init(struct machine *m, const char *sample_dir, int buffer);
+void audio_out(struct machine *m, int port, uint8_t byte);
+void audio_close(struct machine *m);
+void audio_free(struct machine *m);
+
+/* bus */
+void bus_map(struct machine *m, int page, int count, int phys, uint8_t flags);
+void bus_map_invaders(struct machine *m);
+void bus_rebase(struct machine *m);
+void bus_watch(struct machine *m, int phys, uint8_t reasons);
+void bus_unwatch(struct machine *m, int phys, uint8_t reasons);
+
+/* cpm */
+void load_com(struct machine *m, char *path);
+void cpm_out(struct machine *m, int dev);
+
+/* kernels */
+void load_kernel(struct machine *m, char *name);
+
+/* profile */
+#ifdef PROFILE
+void profile_record(struct machine *m, uint16_t pc, uint8_t opcode, uint32_t cycles);
+void print_profile(struct machine *m, int top);
+#endif
 
 /* disassemble */
-int disassemble8080(uint8_t *codebuffer, int pc);
+int disassemble8080(const uint8_t *memory, uint16_t pc, char *buf, size_t size);
 
 /* hardware */
-void device_out(int dev, uint8_t byte);
-void input();
-void shift_hardware(int dev, uint8_t byte);
-void initialize_sdl();
+void device_out(struct machine *m, int dev, uint8_t byte);
+void shift_hardware(struct machine *m, int dev, uint8_t byte);
+void initialize_sdl(struct machine *m, int overlay);
 void quit_sdl();
-void display();
+int display(struct machine *m);
+void run_frontend(struct machine *m, int core);
+void set_speed(struct machine *m, int speed, int frameskip);
 
 /* error */
 void die_error(char *format, ...);
 
 /* instructions */
-void arithmetic_logic(int op, uint8_t data);
-void increment(int regnum);
-void decrement(int regnum);
-void jump(int cond, int op, uint16_t addr, int condflg);
-void direct_address(int op, uint16_t addr);
-void rotate(int op);
-void dad(int regpair);
-void reset(int loc);
-void xchg();
-void xthl();
-void sta(uint16_t addr);
-void lda(uint16_t addr);
-void shld(uint16_t addr);
-void lhld(uint16_t addr);
-void sphl();
-void pop(int regpair);
-void push(int regpair);
+void arithmetic_logic(struct machine *m, int op, uint8_t data);
+void increment(struct machine *m, int regnum);
+void decrement(struct machine *m, int regnum);
+void daa(struct machine *m);
+void bench_alu(struct machine *m, int iterations);
+void jump(struct machine *m, int cond, int op, uint16_t addr, int condflg);
+void direct_address(struct machine *m, int op, uint16_t addr);
+void rotate(struct machine *m, int op);
+void dad(struct machine *m, int regpair);
+void reset(struct machine *m, int loc);
+void xchg(struct machine *m);
+void xthl(struct machine *m);
+void pop(struct machine *m, int regpair);
+void push(struct machine *m, int regpair);
 
 #endif
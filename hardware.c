@@ -1,48 +1,143 @@
+#include <pthread.h>
 #include <signal.h>
-#include <time.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include <SDL2/SDL.h>
 
 #include "emulator.h"
 
-#define WIDTH  224
-#define HEIGHT 256
-
-#define MIDDLE 0
-#define BOTTOM 1
+#define WIDTH  SCREEN_WIDTH
+#define HEIGHT SCREEN_HEIGHT
+
+#define KEYMAP_SIZE 11
+
+/* The CPU runs on its own thread and the main thread presents. Completed
+ * frames go through a lock-free triple buffer: the emulation thread owns
+ * `back`, the presentation thread owns `front`, and the third buffer sits in
+ * `shared` together with a flag saying whether it holds a frame the presenter
+ * has not shown yet. Either side swaps its buffer with the shared one in a
+ * single atomic exchange, so neither ever waits for the other. */
+#define FRESH 4
+
+struct frontend {
+  SDL_Window *window;
+  SDL_Surface *window_surface;
+  SDL_Surface *buffers[3];
+  atomic_int shared; /* index of the spare buffer, | FRESH once published */
+  int front; /* presentation thread */
+  int back; /* emulation thread */
+
+  /* Emulation thread */
+  struct machine *machine;
+  int core;
+  pthread_t thread;
+  int running; /* the thread has been started */
+  atomic_int quit; /* asks the thread to finish its batch and return */
+  struct renderer renderer;
+  uint32_t work[WIDTH * HEIGHT]; /* kept current from VRAM, copied to `back` per frame */
+  int work_changed; /* since the last published frame */
+  int speed; /* multiple of the real clock rate, 0 = unlimited */
+  int frameskip; /* render one frame in this many */
+  uint64_t frame; /* frames since start, for frameskip */
+  Uint32 start_ticks; /* wall time the throttle is synchronized to */
+  uint64_t start_cycles; /* emulated time at start_ticks */
+
+  /* Presentation thread, read by the emulation thread at vblank */
+  uint8_t held[KEYMAP_SIZE]; /* keys currently down, indexed like keymap */
+  atomic_uint ports; /* port 1 | port 2 << 8, built from held */
+  atomic_int rewinds; /* rewind requests not yet serviced */
+};
+
+/* SDL is process-wide, so die_error() needs to find the window to tear down
+ * without a machine at hand */
+static struct frontend *active_frontend;
+
+/* Set by SIGINT or by closing the window; the presentation loop shuts down */
+static volatile sig_atomic_t quit_requested;
+
+static _Thread_local int on_emulation_thread;
+
+static void on_sigint(int sig) {
+  quit_requested = 1;
+}
 
-SDL_Window *window;
-SDL_Surface *window_surface;
-SDL_Surface *video;
+/* Waits for the emulation thread to return, so nothing writes the surfaces */
+static void stop_emulation(struct frontend *fe) {
+  if (!fe->running)
+    return;
 
+  atomic_store(&fe->quit, 1);
+  pthread_join(fe->thread, NULL);
+  fe->running = 0;
+}
 
 void quit_sdl() {
-  SDL_FreeSurface(video);
-  SDL_DestroyWindow(window);
+  struct frontend *fe = active_frontend;
+  int i;
+
+  if (fe) {
+    /* die_error() on the emulation thread: the presenter may still be using
+     * the surfaces, so leave them to the exit */
+    if (on_emulation_thread)
+      exit(1);
+
+    stop_emulation(fe);
+    audio_close(fe->machine);
+    for (i = 0; i < 3; i++)
+      SDL_FreeSurface(fe->buffers[i]);
+    SDL_DestroyWindow(fe->window);
+  }
+
   SDL_Quit();
   exit(1);
 }
 
-void initialize_sdl() {
-  signal(SIGINT, quit_sdl);
+void initialize_sdl(struct machine *m, int overlay) {
+  struct frontend *fe;
+  int i;
+
+  if ((fe = calloc(1, sizeof(struct frontend))) == NULL)
+    die_error("Could not allocate frontend\n");
+
+  m->frontend = active_frontend = fe;
+  fe->machine = m;
+  signal(SIGINT, on_sigint);
 
   if (SDL_Init(SDL_INIT_VIDEO|SDL_INIT_AUDIO) != 0)
     die_error("SDL_Init(): %s\n", SDL_GetError());
 
-  if ((window = SDL_CreateWindow("8080 Emulator", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+  if ((fe->window = SDL_CreateWindow("8080 Emulator", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
           WIDTH*4, HEIGHT*4, 0)) == NULL)
       die_error("SDL_CreateWindow(): %s\n", SDL_GetError());
 
-  if ((window_surface = SDL_GetWindowSurface(window)) == NULL)
+  if ((fe->window_surface = SDL_GetWindowSurface(fe->window)) == NULL)
     die_error("SDL_GetWindowSurface(): %s\n", SDL_GetError());
 
-  if((video = SDL_CreateRGBSurface(0, WIDTH, HEIGHT, 32, 0, 0, 0, 0)) == NULL)
-    die_error("SDL_CreateRGBSurface(): %s\n", SDL_GetError());
-
+  for (i = 0; i < 3; i++)
+    if((fe->buffers[i] = SDL_CreateRGBSurface(0, WIDTH, HEIGHT, 32, 0, 0, 0, 0)) == NULL)
+      die_error("SDL_CreateRGBSurface(): %s\n", SDL_GetError());
+
+  fe->front = 0;
+  atomic_init(&fe->shared, 1);
+  fe->back = 2;
+  atomic_init(&fe->ports, 0x08);
+  atomic_init(&fe->rewinds, 0);
+  atomic_init(&fe->quit, 0);
+  fe->speed = 1;
+  fe->frameskip = 1;
+
+  init_renderer(&fe->renderer, SDL_MapRGB(fe->buffers[0]->format, 255, 255, 255),
+                SDL_MapRGB(fe->buffers[0]->format, 255, 32, 32), SDL_MapRGB(fe->buffers[0]->format, 32, 255, 32),
+                overlay);
+
+  /* Draw the whole screen on the first frame */
+  memset(m->vram_dirty, 0xFF, sizeof(m->vram_dirty));
 }
 
-void blit_video() {
+void blit_video(struct frontend *fe) {
   SDL_Rect src_rect;
   SDL_Rect dst_rect;
 
@@ -57,108 +152,183 @@ void blit_video() {
   dst_rect.w = 4 * WIDTH;
   dst_rect.h = 4 * HEIGHT;
 
-  if (SDL_BlitScaled(video, &src_rect, window_surface, &dst_rect) < 0)
+  if (SDL_BlitScaled(fe->buffers[fe->front], &src_rect, fe->window_surface, &dst_rect) < 0)
     die_error("SDL_BlitScaled: %s\n", SDL_GetError());
 }
 
-int get_rotated_index(int i) {
-  int col = i / HEIGHT;
-  int row = HEIGHT - (i % HEIGHT) - 1;
+/* Runs the machine at `speed` times the real clock rate (0 = as fast as the
+ * host allows) and renders only every `frameskip`th frame. Interrupts keep
+ * firing on emulated time either way. */
+void set_speed(struct machine *m, int speed, int frameskip) {
+  struct frontend *fe = m->frontend;
 
-  //usleep(50000);
-  //printf("Got row %d, col %d, i:%d for row %d, col %d, i:%d\n", row, col, WIDTH * row + col, i / HEIGHT, i % HEIGHT, i);
-  return WIDTH * row + col;
+  fe->speed = speed;
+  fe->frameskip = frameskip > 1 ? frameskip : 1;
+  fe->start_ticks = 0; /* resynchronize */
 }
 
-void copy_half(int half) {
-  int i, j, k;
-  uint16_t high, low;
-  uint32_t *pixels = video->pixels;
-  uint8_t byte;
-
-  /* Video RAM is addresses 0x2400-0x3FFF, 256x224 resolution */
-  /* We want to copy half of the screen every 1/60 seconds */
-  /* Byte 0x3400 is what space invaders considers the "middle" */
-
-  if (half == MIDDLE) {
-    low = 0x2400;
-    high = 0x3400;
-    i = 0;
-  } else {
-    low = 0x3400;
-    high = 0x4000;
-    i = 0x1000 * 8; /* One bit per pixel */
+/* Sleeps so that emulated time does not run ahead of wall time. Called once
+ * per half frame; if the host falls far behind we resynchronize instead of
+ * racing to catch up. */
+static void throttle(struct machine *m) {
+  struct frontend *fe = m->frontend;
+  Uint32 now, target;
+
+  if (fe->speed == 0)
+    return;
+
+  now = SDL_GetTicks();
+  if (m->state.cycles < fe->start_cycles) /* emulated time went backwards */
+    fe->start_ticks = 0;
+  target = fe->start_ticks + (Uint32) ((m->state.cycles - fe->start_cycles) * 1000 / ((uint64_t) CLOCK_HZ * fe->speed));
+
+  if (!fe->start_ticks || now > target + 100) {
+    fe->start_ticks = now;
+    fe->start_cycles = m->state.cycles;
+  } else if (target > now) {
+    SDL_Delay(target - now);
   }
+}
 
-  for (j = low; j < high; j++) {
-    byte = memory[j];
+/* Hands the finished frame to the presentation thread */
+static void publish_frame(struct frontend *fe) {
+  SDL_Surface *dst = fe->buffers[fe->back];
+  int y;
 
-    for (k = 0; k < 8; k++) {
-      if (byte & 0x01) /* Pixels are either on or off, I use white and black for the colors */
-        *(pixels + get_rotated_index(i)) = SDL_MapRGB(video->format, 255, 255, 255);
-      else
-        *(pixels + get_rotated_index(i)) = 0;
+  for (y = 0; y < HEIGHT; y++)
+    memcpy((uint8_t *) dst->pixels + y * dst->pitch, fe->work + y * WIDTH, WIDTH * sizeof(uint32_t));
 
-      byte >>= 1;
-      i++;
-    }
+  fe->back = atomic_exchange(&fe->shared, fe->back | FRESH) & 3;
+}
+
+/* Picks up what the presentation thread saw of the keyboard */
+static void latch_input(struct machine *m) {
+  struct frontend *fe = m->frontend;
+  unsigned ports = atomic_load(&fe->ports);
+  int rewinds = atomic_exchange(&fe->rewinds, 0);
+
+  if (rewinds) {
+    rewind_frames(m, 60 * rewinds); /* one second each */
+    fe->start_ticks = 0; /* the cycle count went back, resynchronize the throttle */
   }
+
+  set_input_port(m, 1, ports & 0xFF); /* Space Invaders will read the input from here */
+  set_input_port(m, 2, ports >> 8);
 }
 
-/* Simulates the display used by space invaders */
-void display() {
-  static clock_t last_interrupt = 0;
-  static int loc = MIDDLE;
-
-  if (state.interrupts_enabled && (((double) (clock() - last_interrupt) / (double) CLOCKS_PER_SEC) > 1.0 / 60.0)) {
-    copy_half(loc);
-
-    switch (loc) {
-      case MIDDLE:
-        interrupt(0xcf); /* RST 1 */
-        break;
-      case BOTTOM:
-        interrupt(0xd7); /* RST 7 */
-        break;
+/* Simulates the display used by space invaders. emulate() calls it on the
+ * emulation thread after every run_until() batch; it only does work when the
+ * batch ended on a screen interrupt. Returns 0 once the frontend wants the
+ * thread to stop. */
+int display(struct machine *m) {
+  struct frontend *fe = m->frontend;
+  int half = screen_interrupt(m), draw;
+
+  if (half < 0)
+    return !atomic_load(&fe->quit);
+
+  draw = (fe->frame % fe->frameskip) == 0;
+
+  /* Skipped frames leave their dirty bits for the next drawn frame */
+  if (draw && render_half(m, &fe->renderer, half, fe->work, WIDTH) > 0)
+    fe->work_changed = 1;
+
+  if (half == BOTTOM) {
+    /* Nothing to present if no pixel changed during the frame */
+    if (draw && fe->work_changed) {
+      publish_frame(fe);
+      fe->work_changed = 0;
     }
 
-    blit_video();
-    SDL_UpdateWindowSurface(window);
+    fe->frame++;
 
-    loc = !loc;
-    last_interrupt = clock();
+    latch_input(m);
   }
+
+  throttle(m);
+  return !atomic_load(&fe->quit);
+}
+
+/* Cabinet controls. Port 1 bit 3 is always high; port 2 also carries the
+ * DIP switches, which we leave at 0 (three ships). */
+static const struct {
+  SDL_Keycode key;
+  uint8_t port;
+  uint8_t bit;
+} keymap[KEYMAP_SIZE] = {
+  {SDLK_c, 1, 0x01}, /* Insert quarter */
+  {SDLK_2, 1, 0x02}, /* 2 player start */
+  {SDLK_RETURN, 1, 0x04}, /* 1 player start */
+  {SDLK_1, 1, 0x04},
+  {SDLK_SPACE, 1, 0x10}, /* Fire */
+  {SDLK_LEFT, 1, 0x20}, /* Left */
+  {SDLK_RIGHT, 1, 0x40}, /* Right */
+  {SDLK_t, 2, 0x04}, /* Tilt */
+  {SDLK_w, 2, 0x10}, /* Player 2 fire */
+  {SDLK_a, 2, 0x20}, /* Player 2 left */
+  {SDLK_d, 2, 0x40}, /* Player 2 right */
+};
+
+/* Applies one SDL event to the held-key table. The emulation thread latches
+ * the resulting port values once per frame, so a key counts for as long as it
+ * is held. */
+static void handle_event(struct frontend *fe, SDL_Event *event) {
+  uint8_t ports[3] = {0, 0x08, 0};
+  int i;
+
+  if (event->type == SDL_QUIT)
+    quit_requested = 1;
+
+  if (event->type != SDL_KEYDOWN && event->type != SDL_KEYUP)
+    return;
+
+  if (event->type == SDL_KEYDOWN && event->key.keysym.sym == SDLK_BACKSPACE && !event->key.repeat)
+    atomic_fetch_add(&fe->rewinds, 1);
+
+  for (i = 0; i < KEYMAP_SIZE; i++)
+    if (keymap[i].key == event->key.keysym.sym)
+      fe->held[i] = (event->type == SDL_KEYDOWN);
+
+  for (i = 0; i < KEYMAP_SIZE; i++)
+    if (fe->held[i])
+      ports[keymap[i].port] |= keymap[i].bit;
+
+  atomic_store(&fe->ports, ports[1] | ports[2] << 8);
 }
 
-void input() {
+static void *emulation_thread(void *arg) {
+  struct frontend *fe = arg;
+
+  on_emulation_thread = 1;
+  emulate(fe->machine, fe->core);
+  return NULL;
+}
+
+/* Starts the CPU on its own thread and presents frames and pumps events on
+ * this one until the window is closed. SDL wants both on the thread that
+ * created the window. */
+void run_frontend(struct machine *m, int core) {
+  struct frontend *fe = m->frontend;
   SDL_Event event;
-  uint8_t inp1 = 0x08, inp2;
-
-  while (SDL_PollEvent(&event)) {
-    if (event.type == SDL_QUIT)
-      quit_sdl();
-
-    if (event.type == SDL_KEYDOWN) {
-      switch (event.key.keysym.sym) {
-        case SDLK_c:
-          inp1 |= 0x01; /* Insert quarter */
-          break;
-
-        case SDLK_RETURN: /* Start */
-          inp1 |= 0x04;
-          break;
-        case SDLK_SPACE: /* Fire */
-          inp1 |= 0x10;
-          break;
-        case SDLK_LEFT: /* Left */
-          inp1 |= 0x20;
-          break;
-        case SDLK_RIGHT: /* Right */
-          inp1 |= 0x40;
-          break;
-      }
+
+  fe->core = core;
+  if (pthread_create(&fe->thread, NULL, emulation_thread, fe) != 0)
+    die_error("pthread_create() failed\n");
+  fe->running = 1;
+
+  while (!quit_requested) {
+    if (SDL_WaitEventTimeout(&event, 2)) {
+      do
+        handle_event(fe, &event);
+      while (SDL_PollEvent(&event));
+    }
+
+    if (atomic_load(&fe->shared) & FRESH) {
+      fe->front = atomic_exchange(&fe->shared, fe->front) & 3;
+      blit_video(fe);
+      SDL_UpdateWindowSurface(fe->window);
     }
   }
 
-  state.input_pins[1] = inp1; /* Space Invaders will read the input from here */
+  quit_sdl();
 }
@@ -0,0 +1,75 @@
+#include <stdio.h>
+#include <sys/resource.h>
+#include <time.h>
+#include "emulator.h"
+
+/* Runs the machine without SDL: no window, no event polling. The two
+ * screen interrupts are synthesized every half frame of emulated time. */
+
+static double now() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+/* Runs until `frames` full frames or `cycles` emulated cycles have elapsed,
+ * whichever comes first, or until the program stops the machine. Zero means
+ * no limit for that bound. The dispatch
+ * core must have been set up with init_dispatch() beforehand, and the JIT
+ * core additionally with jit_init(m). */
+void run_headless(struct machine *m, int core, uint64_t frames, uint64_t cycles, struct run_stats *stats) {
+  uint64_t start_cycles = m->state.cycles, start_instructions = m->instructions, start_idle = m->idle_cycles;
+  uint64_t frame_count = 0;
+  double start = now();
+
+  while (!m->stopped && (!frames || frame_count < frames) && (!cycles || m->state.cycles - start_cycles < cycles)) {
+    run_until(m, core, cycles ? start_cycles + cycles : UINT64_MAX);
+
+    if (screen_interrupt(m) == BOTTOM)
+      frame_count++;
+  }
+
+  stats->instructions = m->instructions - start_instructions;
+  stats->cycles = m->state.cycles - start_cycles;
+  stats->frames = frame_count;
+  stats->idle_cycles = m->idle_cycles - start_idle;
+  stats->seconds = now() - start;
+}
+
+/* Largest resident set size of the process so far, in KB */
+static long peak_rss_kb() {
+  struct rusage usage;
+
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+void print_run_stats(const struct run_stats *stats) {
+  printf("instructions: %llu\n", (unsigned long long) stats->instructions);
+  printf("cycles:       %llu\n", (unsigned long long) stats->cycles);
+  printf("frames:       %llu\n", (unsigned long long) stats->frames);
+  printf("idle skipped: %llu cycles (%.1f%%)\n", (unsigned long long) stats->idle_cycles,
+         stats->cycles ? 100.0 * stats->idle_cycles / stats->cycles : 0.0);
+  printf("wall time:    %.6f s\n", stats->seconds);
+
+  if (stats->seconds > 0) {
+    printf("MIPS:         %.2f\n", stats->instructions / stats->seconds / 1e6);
+    printf("emulated MHz: %.2f\n", stats->cycles / stats->seconds / 1e6);
+  }
+
+  if (stats->frames > 0)
+    printf("ns/frame:     %.0f\n", stats->seconds * 1e9 / stats->frames);
+  printf("peak RSS:     %ld KB\n", peak_rss_kb());
+}
+
+/* One line of RUN_STATS_CSV_HEADER columns, for scripts */
+void print_run_stats_csv(const struct run_stats *stats) {
+  double s = stats->seconds > 0 ? stats->seconds : 1e-9;
+
+  printf("%llu,%llu,%llu,%.6f,%.2f,%.2f,%.0f,%ld,%llu\n", (unsigned long long) stats->instructions,
+         (unsigned long long) stats->cycles, (unsigned long long) stats->frames, stats->seconds,
+         stats->instructions / s / 1e6, stats->cycles / s / 1e6,
+         stats->frames ? stats->seconds * 1e9 / stats->frames : 0.0, peak_rss_kb(),
+         (unsigned long long) stats->idle_cycles);
+}
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <time.h>
 #include "emulator.h"
 
 #define ADD 0
@@ -24,196 +25,270 @@
 #define STA  2
 #define LDA  3
 
-void mov(uint8_t opcode) {
+void mov(struct machine *m, uint8_t opcode) {
   int src = opcode & 0x7; /* The source register is defined by the last three bits */
   int dest = (opcode >> 3) & 0x7; // The destination register is defined by the 4th, 5th, and 6th bits
-  set_register_content(dest, get_register_content(src));
+  set_register_content(m, dest, get_register_content(m, src));
 }
 
-void arithmetic_logic(int op, uint8_t data) {
-  uint16_t result;
+/* The adder. The 8080 subtracts by adding the complement of the operand with
+ * the borrow inverted, so every arithmetic op is a + b + carry-in on 9 bits.
+ * Bit 8 of the sum is the carry (inverted again for a borrow) and bit 4 of
+ * a ^ b ^ sum is the carry out of bit 3, which is AC. */
+static inline uint16_t add8(struct state *s, uint8_t b, int carry_in, int subtract) {
+  uint16_t result = s->reg_a + b + carry_in;
 
-  state.flag_cy = state.flag_ac = 0; /* Reset the carry flags */
+  s->flag_cy = ((result >> 8) ^ subtract) & 1;
+  s->flag_ac = ((s->reg_a ^ b ^ result) >> 4) & 1;
+  return result & 0xFF;
+}
+
+/* Only the carries are computed here. Z, S and P are derived from flag_zsp
+ * when something reads them (see utility.c). None of the flags depends on a
+ * branch, only the choice of operation does. */
+void arithmetic_logic(struct machine *m, int op, uint8_t data) {
+  struct state *s = &m->state;
+  uint8_t result;
 
-  /* Calculate the appropriate result based on the opcode */
   switch (op) {
     case ADD:
-      result = (uint16_t) get_register_content(REG_A) + (uint16_t) data;
+      result = add8(s, data, 0, 0);
       break;
     case ADC:
-      result = (uint16_t) get_register_content(REG_A) + (uint16_t) data + (uint16_t) state.flag_cy;
+      result = add8(s, data, s->flag_cy, 0);
       break;
     case SUB:
     case CMP:
-      result = (uint16_t) get_register_content(REG_A) - (uint16_t) data;
+      result = add8(s, ~data, 1, 1);
       break;
     case SBB:
-      result = (uint16_t) get_register_content(REG_A) - (uint16_t) data - (uint16_t) state.flag_cy;
+      result = add8(s, ~data, !s->flag_cy, 1);
       break;
     case ANA:
-      result = (uint16_t) get_register_content(REG_A) & (uint16_t) data;
+      result = s->reg_a & data;
+      s->flag_cy = 0;
+      s->flag_ac = ((s->reg_a | data) >> 3) & 1; /* an 8080 quirk */
       break;
     case XRA:
-      result = (uint16_t) get_register_content(REG_A) ^ (uint16_t) data;
+      result = s->reg_a ^ data;
+      s->flag_cy = s->flag_ac = 0;
       break;
     case ORA:
-      result = (uint16_t) get_register_content(REG_A) | (uint16_t) data;
+    default:
+      result = s->reg_a | data;
+      s->flag_cy = s->flag_ac = 0;
       break;
   }
 
-  /* Set the flags */
-  if ((op == SUB) || (op == SBB) || (op == CMP)) {
-    state.flag_cy = (result < 0xFF);
-  } else {
-    state.flag_cy = (result > 0xFF);
-  }
-
-  state.flag_z = !result;
-  state.flag_s = ((result & 0x80) == 0x80); /* Mask the get the sign bit -- 0x80 == 10000000 */
-  state.flag_p = check_parity((uint8_t) result);
+  s->flag_zsp = result;
+  FLAG_STAT(m, flag_updates);
 
   if (op != CMP) {
-    set_register_content(REG_A, result & 0xFF);
+    s->reg_a = result;
   }
 }
 
-void increment(int regnum) {
-  uint16_t result = (uint16_t) get_register_content(regnum) + 1;
+/* INR and DCR leave the carry alone */
+void increment(struct machine *m, int regnum) {
+  uint8_t result = get_register_content(m, regnum) + 1;
 
-  state.flag_cy = (result > 0xFF);
-  state.flag_z = !result;
-  state.flag_s = ((result & 0x80) == 0x80); /* Mask the get the sign bit -- 0x80 == 10000000 */
-  state.flag_p = check_parity((uint8_t) result);
+  m->state.flag_zsp = result;
+  m->state.flag_ac = (result & 0xF) == 0;
+  FLAG_STAT(m, flag_updates);
 
-  set_register_content(regnum, result & 0xFF);
+  set_register_content(m, regnum, result);
 }
 
-void dad(int regpair) {
-  uint32_t result = (uint32_t) get_register_pair(regpair) + (uint32_t) get_register_pair(HL);
-  state.flag_cy = (result > 0xFFFF);
-  set_register_pair(HL, result & 0xFFFF);
+void dad(struct machine *m, int regpair) {
+  uint32_t result = (uint32_t) get_register_pair(m, regpair) + (uint32_t) get_register_pair(m, HL);
+  m->state.flag_cy = (result > 0xFFFF);
+  set_register_pair(m, HL, result & 0xFFFF);
 }
 
-void decrement(int regnum) {
-  uint16_t result = (uint16_t) get_register_content(regnum) - 1;
+void decrement(struct machine *m, int regnum) {
+  uint8_t result = get_register_content(m, regnum) - 1;
 
-  state.flag_cy = (result < 0xFF);
-  state.flag_z = !result;
-  state.flag_s = ((result & 0x80) == 0x80);
-  state.flag_p = check_parity((uint8_t) result);
+  m->state.flag_zsp = result;
+  m->state.flag_ac = (result & 0xF) != 0xF;
+  FLAG_STAT(m, flag_updates);
 
-  set_register_content(regnum, result & 0xFF);
+  set_register_content(m, regnum, result);
 }
 
-void jump(int cond, int op, uint16_t addr, int condflg) {
-  if (op != RET)
-    state.pc += 2;
+/* DAA, indexed and laid out as A | CY << 8 | AC << 9: each entry holds the
+ * adjusted accumulator and the carries that come out of it */
+#define DAA_FIX(i) (((((i) & 0xF) > 9 || ((i) & 0x200)) ? 0x06 : 0) | ((((i) & 0xFF) > 0x99 || ((i) & 0x100)) ? 0x60 : 0))
+#define DAA_ENTRY(i) \
+  ((((i) + DAA_FIX(i)) & 0xFF) | ((DAA_FIX(i) & 0x60) ? 0x100 : 0) | ((((i) & 0xF) + (DAA_FIX(i) & 0xF)) > 0xF ? 0x200 : 0))
+#define D4(i) DAA_ENTRY(i), DAA_ENTRY(i + 1), DAA_ENTRY(i + 2), DAA_ENTRY(i + 3)
+#define D16(i) D4(i), D4(i + 4), D4(i + 8), D4(i + 12)
+#define D64(i) D16(i), D16(i + 16), D16(i + 32), D16(i + 48)
+#define D256(i) D64(i), D64(i + 64), D64(i + 128), D64(i + 192)
+
+static const uint16_t daa_table[1024] = { D256(0), D256(0x100), D256(0x200), D256(0x300) };
+
+/* Adjusts A to packed BCD after an addition */
+void daa(struct machine *m) {
+  struct state *s = &m->state;
+  uint16_t adjusted = daa_table[s->reg_a | s->flag_cy << 8 | s->flag_ac << 9];
+
+  s->reg_a = adjusted & 0xFF;
+  s->flag_cy = (adjusted >> 8) & 1;
+  s->flag_ac = adjusted >> 9;
+  s->flag_zsp = s->reg_a;
+  FLAG_STAT(m, flag_updates);
+}
 
-  if (!get_cond(cond, op, condflg))
+/* pc is already past the instruction */
+void jump(struct machine *m, int cond, int op, uint16_t addr, int condflg) {
+  if (!get_cond(m, cond, op, condflg))
     return;
 
+  if (!condflg && op != JMP) /* Conditional CALL/RET take longer when taken */
+    m->state.cycles += COND_TAKEN_CYCLES;
+
   switch(op) {
     case RET:
-      state.pc = pop_stack();
+      m->state.pc = pop_stack(m);
       return;
     case JMP:
-      state.pc = addr;
+      m->state.pc = addr;
       break;
     case CALL:
-      push_stack(state.pc);
-      state.pc = addr;
+      push_stack(m, m->state.pc);
+      m->state.pc = addr;
       break;
   }
 }
 
-void direct_address(int op, uint16_t addr) {
+void direct_address(struct machine *m, int op, uint16_t addr) {
   switch (op) {
     case SHLD:
-      memory[addr] = state.reg_l;
-      memory[addr + 1] = state.reg_h;
+      write_memory(m, addr, m->state.reg_l);
+      write_memory(m, addr + 1, m->state.reg_h);
       break;
     case LHLD:
-      state.reg_l = memory[addr];
-      state.reg_h = memory[addr+1];
+      m->state.reg_l = read_memory(m, addr);
+      m->state.reg_h = read_memory(m, addr+1);
       break;
     case STA:
-      memory[addr] = state.reg_a;
+      write_memory(m, addr, m->state.reg_a);
       break;
     case LDA:
-      state.reg_a = memory[addr];
+      m->state.reg_a = read_memory(m, addr);
       break;
   }
 }
 
-void reset(int loc) {
-  push_stack(state.pc);
+void reset(struct machine *m, int loc) {
+  push_stack(m, m->state.pc);
 
   switch (loc) {
-    case 0: state.pc = 0x0000; return;
-    case 1: state.pc = 0x0008; return;
-    case 2: state.pc = 0x0010; return;
-    case 3: state.pc = 0x0018; return;
-    case 4: state.pc = 0x0020; return;
-    case 5: state.pc = 0x0028; return;
-    case 6: state.pc = 0x0030; return;
-    case 7: state.pc = 0x0038; return;
+    case 0: m->state.pc = 0x0000; return;
+    case 1: m->state.pc = 0x0008; return;
+    case 2: m->state.pc = 0x0010; return;
+    case 3: m->state.pc = 0x0018; return;
+    case 4: m->state.pc = 0x0020; return;
+    case 5: m->state.pc = 0x0028; return;
+    case 6: m->state.pc = 0x0030; return;
+    case 7: m->state.pc = 0x0038; return;
   }
 }
 
-void push(int regpair) {
+void push(struct machine *m, int regpair) {
   uint16_t data;
   if (regpair == 3) { /* Small workaround -- this normally signifies the SP register except for push and pop */
-    data = get_register_pair(FA);
+    data = get_register_pair(m, FA);
   } else {
-    data = get_register_pair(regpair);
+    data = get_register_pair(m, regpair);
   }
 
-  push_stack(data);
+  push_stack(m, data);
 }
 
-void pop(int regpair) {
-  uint16_t data = pop_stack();
+void pop(struct machine *m, int regpair) {
+  uint16_t data = pop_stack(m);
 
   if (regpair == 3) { /* Small workaround -- this normally signifies the SP register except for push and pop */
-    set_register_pair(FA, data);
+    set_register_pair(m, FA, data);
   } else {
-    set_register_pair(regpair, data);
+    set_register_pair(m, regpair, data);
   }
 }
 
-void rotate(int op) {
-  int highbit = (state.reg_a & (1 << 7)) >> 7;
-  int lowbit = state.reg_a & 1;
+void rotate(struct machine *m, int op) {
+  int highbit = (m->state.reg_a & (1 << 7)) >> 7;
+  int lowbit = m->state.reg_a & 1;
 
   switch (op) {
     case RLC:
-      state.reg_a = (state.reg_a << 1) | highbit;
-      state.flag_cy = highbit;
+      m->state.reg_a = (m->state.reg_a << 1) | highbit;
+      m->state.flag_cy = highbit;
       break;
     case RRC:
-      state.reg_a = (state.reg_a >> 1) | (lowbit << 7);
-      state.flag_cy = lowbit;
+      m->state.reg_a = (m->state.reg_a >> 1) | (lowbit << 7);
+      m->state.flag_cy = lowbit;
       break;
     case RAL:
-      state.reg_a = (state.reg_a << 1) | state.flag_cy;
-      state.flag_cy = highbit;
+      m->state.reg_a = (m->state.reg_a << 1) | m->state.flag_cy;
+      m->state.flag_cy = highbit;
       break;
     case RAR:
-      state.reg_a = (state.reg_a >> 1) | (state.flag_cy << 7);
-      state.flag_cy = lowbit;
+      m->state.reg_a = (m->state.reg_a >> 1) | (m->state.flag_cy << 7);
+      m->state.flag_cy = lowbit;
       break;
   }
 }
 
-void xchg() {
-  uint16_t tmp = get_register_pair(HL);
-  set_register_pair(HL, get_register_pair(DE));
-  set_register_pair(DE, tmp);
+void xchg(struct machine *m) {
+  uint16_t tmp = get_register_pair(m, HL);
+  set_register_pair(m, HL, get_register_pair(m, DE));
+  set_register_pair(m, DE, tmp);
 }
 
-void xthl() {
-  uint16_t tmp = pop_stack();
-  push_stack(get_register_pair(HL));
-  set_register_pair(HL, tmp);
+void xthl(struct machine *m) {
+  uint16_t tmp = pop_stack(m);
+  push_stack(m, get_register_pair(m, HL));
+  set_register_pair(m, HL, tmp);
 }
 
+
+static double now_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Times each ALU operation on its own, with operands that change every call
+ * so nothing is predictable. The machine's registers are left as they were. */
+void bench_alu(struct machine *m, int iterations) {
+  static const char *names[] = {"ADD", "ADC", "SUB", "SBB", "ANA", "XRA", "ORA", "CMP", "INR", "DCR", "DAA"};
+  struct state saved = m->state;
+  double start, ns;
+  int op, i;
+
+  for (op = 0; op < (int) (sizeof(names) / sizeof(names[0])); op++) {
+    m->state.reg_a = 0;
+    m->state.flag_cy = 0;
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++) {
+      if (op < 8)
+        arithmetic_logic(m, op, i * 167); /* an odd step visits every byte */
+      else if (op == 8)
+        increment(m, REG_A);
+      else if (op == 9)
+        decrement(m, REG_A);
+      else {
+        m->state.reg_a += i * 167;
+        daa(m);
+      }
+    }
+    ns = (now_ns() - start) / iterations;
+
+    printf("%-4s %6.2f ns/op  %7.1f Mops/s\n", names[op], ns, 1e3 / ns);
+  }
+
+  m->state = saved;
+}
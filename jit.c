@@ -0,0 +1,846 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include "emulator.h"
+
+/* x86-64 dynamic recompiler. Guest basic blocks are translated on first use
+ * into host code keyed by their start PC. Data moves, immediate loads, 16-bit
+ * register arithmetic, memory loads and jumps are emitted inline; everything
+ * that touches flags or stores to memory calls the dispatch core's handler
+ * for that opcode, so the JIT shares the interpreter's semantics exactly.
+ *
+ * While a block runs, rbx holds the machine and r13 the translation cache.
+ * Blocks with a static successor jump straight into it once it has been
+ * translated (chaining); blocks ending in CALL/RET/RST/PCHL look the target
+ * up inline. Each block starts by checking that it can run to completion
+ * before the batch limit (see run_until(), never past the next screen
+ * interrupt); if not, control returns to jit_run(), which single-steps the
+ * interpreter up to the limit, so interrupts land on the same instruction
+ * boundary as in the other cores.
+ * IN and OUT are never translated and always run in the interpreter.
+ *
+ * Loads index the bus page table inline. Stores go through write_memory(),
+ * and pages holding translated code are watched; a store to one of their
+ * bytes that is translated code (code_bytes) flags the machine. Data next to
+ * code is stored like any other. Blocks check the flag after every store and
+ * bail out, and jit_run() then drops the blocks covering the bytes that were
+ * written. Every chained jump is remembered by its target, so the jumps into
+ * a dropped block can be pointed back at the exit stub; they are relinked when
+ * the block is translated again, and the dropped block's own jumps are
+ * forgotten. The cache is only emptied as a whole when the code buffer or the
+ * chain records run out.
+ *
+ * Code that keeps rewriting itself would be retranslated over and over. Once
+ * a page has had code stored to JIT_SMC_LIMIT times in quick succession, the
+ * blocks dropped there are left to the interpreter for JIT_SMC_BACKOFF cycles,
+ * doubling every time it happens again. */
+
+#if defined(__x86_64__)
+
+#include <sys/mman.h>
+
+#define JIT_CODE_SIZE (4 << 20)
+#define JIT_MAX_BLOCK 32 /* guest instructions per block */
+#define JIT_MAX_INSN_BYTES 96 /* worst case host bytes per guest instruction */
+#define JIT_MAX_PATCHES 65536
+#define JIT_MAX_BLOCK_BYTES (JIT_MAX_BLOCK * 3)
+#define JIT_SMC_LIMIT 4 /* code stores to a page before it goes to the interpreter */
+#define JIT_SMC_BACKOFF 1000000 /* cycles it stays there the first time */
+#define JIT_SMC_MAX_STRIKES 8 /* the backoff doubles up to this many times */
+
+struct patch {
+  uint8_t *site; /* rel32 of a jump to the target, or to the exit stub while it is not translated */
+  uint16_t target;
+  int next; /* in the target's list, or the free list */
+};
+
+struct jit {
+  uint64_t instructions; /* retired by translated code, must stay first */
+  uint8_t *blocks[MEMSIZE]; /* host entry point per guest pc */
+  uint8_t lengths[MEMSIZE]; /* guest bytes covered by the block at each pc */
+  uint16_t page_blocks[BUS_PAGES]; /* blocks overlapping each page of memory[] */
+  uint16_t code_refs[MEMSIZE]; /* blocks covering each byte of memory[], see code_bytes */
+
+  /* Self-modifying code, per page of memory[]; kept across flushes */
+  uint8_t smc_count[BUS_PAGES]; /* code stores since the page last went quiet */
+  uint8_t smc_strikes[BUS_PAGES]; /* times the page was left to the interpreter */
+  uint64_t smc_last[BUS_PAGES]; /* cycle count of the last code store */
+  uint64_t smc_until[BUS_PAGES]; /* interpreted until this cycle count, 0 if not */
+
+  uint8_t *code; /* executable buffer */
+  uint8_t *ptr; /* next free byte */
+  uint8_t *start; /* first byte after the stubs */
+  uint8_t *exit; /* stub returning to jit_run() */
+  void (*enter)(struct machine *m, struct jit *jit, uint8_t *entry);
+
+  int patch_head[MEMSIZE]; /* chained jumps per target pc, -1 if none */
+  int exits[MEMSIZE][2]; /* chained jumps out of the block at each pc, -1 if none */
+  struct patch patches[JIT_MAX_PATCHES];
+  int npatches; /* ever used since the last flush */
+  int free_head, nfree; /* released by dropped blocks */
+};
+
+/* Offsets of the fields translated code addresses through rbx */
+#define OFF(field) ((int32_t) offsetof(struct machine, field))
+
+/* Host register numbers */
+#define EAX 0
+#define ECX 1
+
+/* How the translator handles each opcode */
+enum {
+  KIND_UNSUPPORTED, /* ends the block before it; the interpreter runs it */
+  KIND_INLINE, /* emitted as host code */
+  KIND_CALL, /* calls the dispatch handler */
+  KIND_CALL_STORE, /* calls the dispatch handler, which may store to memory */
+  KIND_JUMP, /* JMP and Jcc, chained */
+  KIND_CALL_EXIT, /* CALL/Ccc/RST: handler then inline target lookup */
+  KIND_RET_EXIT, /* RET/Rcc/HLT: handler then inline target lookup */
+  KIND_PCHL
+};
+
+#define REG_OFF(reg) (OFF(state.regs) + REG_INDEX(reg))
+#define PAIR_OFF(rp) (OFF(state.pairs) + 2 * (rp))
+
+static int classify(uint8_t opcode) {
+  int dst = (opcode >> 3) & 0x7;
+
+  if (opcode == 0x76)
+    return KIND_RET_EXIT; /* HLT never comes back */
+
+  if (opcode >= 0x40 && opcode < 0x80)
+    return (dst == MEM_REF) ? KIND_CALL_STORE : KIND_INLINE;
+
+  if (opcode >= 0x80 && opcode < 0xC0)
+    return KIND_CALL;
+
+  switch (opcode) {
+    case 0x00: /* NOP */
+    case 0x0A: case 0x1A: /* LDAX */
+    case 0x3A: /* LDA */
+    case 0x2F: case 0x37: /* CMA, STC */
+    case 0xEB: case 0xF9: /* XCHG, SPHL */
+    case 0xF3: case 0xFB: /* DI, EI */
+      return KIND_INLINE;
+    case 0x02: case 0x12: /* STAX */
+    case 0x22: case 0x32: /* SHLD, STA */
+    case 0x34: case 0x35: case 0x36: /* INR M, DCR M, MVI M */
+    case 0xE3: /* XTHL */
+      return KIND_CALL_STORE;
+    case 0x2A: /* LHLD */
+    case 0x27: case 0x3F: /* DAA, CMC */
+    case 0x07: case 0x0F: case 0x17: case 0x1F: /* rotates */
+      return KIND_CALL;
+    case 0xC3:
+      return KIND_JUMP;
+    case 0xCD:
+      return KIND_CALL_EXIT;
+    case 0xC9:
+      return KIND_RET_EXIT;
+    case 0xE9:
+      return KIND_PCHL;
+  }
+
+  switch (opcode & 0xCF) {
+    case 0x01: case 0x03: case 0x0B: /* LXI, INX, DCX */
+      return KIND_INLINE;
+    case 0x09: /* DAD */
+    case 0xC1: /* POP */
+      return KIND_CALL;
+    case 0xC5: /* PUSH */
+      return KIND_CALL_STORE;
+  }
+
+  switch (opcode & 0xC7) {
+    case 0x04: case 0x05: /* INR, DCR */
+      return KIND_CALL;
+    case 0x06: /* MVI */
+      return KIND_INLINE;
+    case 0xC6: /* ALU immediate */
+      return KIND_CALL;
+    case 0xC0: /* Rcc */
+      return KIND_RET_EXIT;
+    case 0xC2: /* Jcc */
+      return KIND_JUMP;
+    case 0xC4: /* Ccc */
+    case 0xC7: /* RST */
+      return KIND_CALL_EXIT;
+  }
+
+  return KIND_UNSUPPORTED; /* IN, OUT, undocumented encodings */
+}
+
+/* Emitters */
+
+static void emit8(struct jit *j, uint8_t b) {
+  *j->ptr++ = b;
+}
+
+static void emit16(struct jit *j, uint16_t v) {
+  memcpy(j->ptr, &v, 2);
+  j->ptr += 2;
+}
+
+static void emit32(struct jit *j, uint32_t v) {
+  memcpy(j->ptr, &v, 4);
+  j->ptr += 4;
+}
+
+static void emit64(struct jit *j, uint64_t v) {
+  memcpy(j->ptr, &v, 8);
+  j->ptr += 8;
+}
+
+/* ModRM for [rbx + disp32] */
+static void mem_rbx(struct jit *j, int reg, int32_t disp) {
+  emit8(j, 0x83 | (reg << 3));
+  emit32(j, disp);
+}
+
+static void load8(struct jit *j, int reg, int32_t off) { /* movzx r32, byte [rbx+off] */
+  emit8(j, 0x0F); emit8(j, 0xB6); mem_rbx(j, reg, off);
+}
+
+static void store8(struct jit *j, int reg, int32_t off) { /* mov byte [rbx+off], r8 */
+  emit8(j, 0x88); mem_rbx(j, reg, off);
+}
+
+static void store8_imm(struct jit *j, int32_t off, uint8_t imm) {
+  emit8(j, 0xC6); mem_rbx(j, 0, off); emit8(j, imm);
+}
+
+static void store16_imm(struct jit *j, int32_t off, uint16_t imm) {
+  emit8(j, 0x66); emit8(j, 0xC7); mem_rbx(j, 0, off); emit16(j, imm);
+}
+
+static void load16(struct jit *j, int reg, int32_t off) { /* movzx r32, word [rbx+off] */
+  emit8(j, 0x0F); emit8(j, 0xB7); mem_rbx(j, reg, off);
+}
+
+static void store16(struct jit *j, int reg, int32_t off) { /* mov word [rbx+off], r16 */
+  emit8(j, 0x66); emit8(j, 0x89); mem_rbx(j, reg, off);
+}
+
+static void add16_imm(struct jit *j, int32_t off, int8_t imm) { /* add word [rbx+off], imm8 */
+  emit8(j, 0x66); emit8(j, 0x83); mem_rbx(j, 0, off); emit8(j, (uint8_t) imm);
+}
+
+static void add64_imm(struct jit *j, int32_t off, uint32_t imm) { /* add qword [rbx+off], imm32 */
+  emit8(j, 0x48); emit8(j, 0x81); mem_rbx(j, 0, off); emit32(j, imm);
+}
+
+static void cmp8_zero(struct jit *j, int32_t off) {
+  emit8(j, 0x80); mem_rbx(j, 7, off); emit8(j, 0);
+}
+
+static void add_retired(struct jit *j, uint32_t n) { /* add qword [r13], n */
+  emit8(j, 0x49); emit8(j, 0x81); emit8(j, 0x45); emit8(j, 0x00); emit32(j, n);
+}
+
+/* eax = read_memory(eax), clobbers ecx */
+static void load_guest_eax(struct jit *j) {
+  emit8(j, 0x89); emit8(j, 0xC1); /* mov ecx, eax */
+  emit8(j, 0xC1); emit8(j, 0xE9); emit8(j, 0x08); /* shr ecx, 8 */
+  emit8(j, 0x48); emit8(j, 0x8B); emit8(j, 0x8C); emit8(j, 0xCB); emit32(j, OFF(bus.read)); /* mov rcx, [rbx+rcx*8+off] */
+  emit8(j, 0x0F); emit8(j, 0xB6); emit8(j, 0xC0); /* movzx eax, al */
+  emit8(j, 0x0F); emit8(j, 0xB6); emit8(j, 0x04); emit8(j, 0x01); /* movzx eax, byte [rcx+rax] */
+}
+
+static uint8_t *jmp32(struct jit *j, uint8_t *target) {
+  uint8_t *site;
+
+  emit8(j, 0xE9);
+  site = j->ptr;
+  emit32(j, (uint32_t) (target - (site + 4)));
+  return site;
+}
+
+static uint8_t *jcc32(struct jit *j, uint8_t cc, uint8_t *target) {
+  uint8_t *site;
+
+  emit8(j, 0x0F); emit8(j, 0x80 | cc);
+  site = j->ptr;
+  emit32(j, (uint32_t) (target - (site + 4)));
+  return site;
+}
+
+static void patch32(uint8_t *site, uint8_t *target) {
+  uint32_t rel = (uint32_t) (target - (site + 4));
+  memcpy(site, &rel, 4);
+}
+
+#define CC_E 0x4
+#define CC_NE 0x5
+#define CC_A 0x7
+
+/* Calls the dispatch handler for `opcode` with the guest pc just past it */
+static void call_handler(struct jit *j, uint8_t opcode, uint16_t pc) {
+  store16_imm(j, OFF(state.pc), pc + 1);
+  emit8(j, 0x48); emit8(j, 0x89); emit8(j, 0xDF); /* mov rdi, rbx */
+  emit8(j, 0x48); emit8(j, 0xBE); emit64(j, (uint64_t) (uintptr_t) &dispatch_table[opcode]); /* mov rsi, op */
+  emit8(j, 0x48); emit8(j, 0xB8); emit64(j, (uint64_t) (uintptr_t) dispatch_table[opcode].fn); /* mov rax, fn */
+  emit8(j, 0xFF); emit8(j, 0xD0); /* call rax */
+}
+
+static int parity_callout(struct machine *m) {
+  return flag_p(&m->state);
+}
+
+/* Tests condition `cond` of a Jcc and returns the host condition code under
+ * which it is taken. Z, S and CY are a single compare against the lazy flag
+ * state; parity needs the table, so it goes through a callout. */
+static uint8_t emit_cond(struct jit *j, uint8_t cond) {
+  switch (cond >> 1) {
+    case 0: /* NZ, Z */
+      cmp8_zero(j, OFF(state.flag_zsp));
+      return (cond & 1) ? CC_E : CC_NE;
+    case 1: /* NC, C */
+      cmp8_zero(j, OFF(state.flag_cy));
+      return (cond & 1) ? CC_NE : CC_E;
+    case 2: /* PO, PE */
+      emit8(j, 0x48); emit8(j, 0x89); emit8(j, 0xDF); /* mov rdi, rbx */
+      emit8(j, 0x48); emit8(j, 0xB8); emit64(j, (uint64_t) (uintptr_t) parity_callout); /* mov rax, fn */
+      emit8(j, 0xFF); emit8(j, 0xD0); /* call rax */
+      emit8(j, 0x85); emit8(j, 0xC0); /* test eax, eax */
+      return (cond & 1) ? CC_NE : CC_E;
+    default: /* P, M */
+      emit8(j, 0x66); emit8(j, 0xF7); mem_rbx(j, 0, OFF(state.flag_zsp)); /* test word [rbx+off], imm16 */
+      emit16(j, 0x80 | ZSP_FORCE_S);
+      return (cond & 1) ? CC_NE : CC_E;
+  }
+}
+
+/* Leaves the block if the last store hit translated code */
+static void check_dirty(struct jit *j, uint32_t retired) {
+  uint8_t *skip;
+
+  cmp8_zero(j, OFF(code_dirty));
+  emit8(j, 0x74); /* je skip */
+  skip = j->ptr;
+  emit8(j, 0);
+  add_retired(j, retired);
+  jmp32(j, j->exit);
+  *skip = (uint8_t) (j->ptr - (skip + 1));
+}
+
+/* Continues at a guest pc known at translation time, jumping straight into
+ * its block once there is one. Returns the chain record, which translate()
+ * has made sure there is room for. */
+static int exit_static(struct jit *j, uint16_t target, uint32_t retired) {
+  int p;
+
+  store16_imm(j, OFF(state.pc), target);
+  add_retired(j, retired);
+
+  if (j->nfree > 0) {
+    p = j->free_head;
+    j->free_head = j->patches[p].next;
+    j->nfree--;
+  } else {
+    p = j->npatches++;
+  }
+
+  j->patches[p].site = jmp32(j, j->blocks[target] != NULL ? j->blocks[target] : j->exit);
+  j->patches[p].target = target;
+  j->patches[p].next = j->patch_head[target];
+  j->patch_head[target] = p;
+  return p;
+}
+
+/* Continues at whatever guest pc the handler left behind */
+static void exit_dynamic(struct jit *j, uint32_t retired) {
+  add_retired(j, retired);
+  emit8(j, 0x0F); emit8(j, 0xB7); mem_rbx(j, EAX, OFF(state.pc)); /* movzx eax, word [pc] */
+  emit8(j, 0x49); emit8(j, 0x8B); emit8(j, 0x84); emit8(j, 0xC5); /* mov rax, [r13+rax*8+blocks] */
+  emit32(j, (uint32_t) offsetof(struct jit, blocks));
+  emit8(j, 0x48); emit8(j, 0x85); emit8(j, 0xC0); /* test rax, rax */
+  jcc32(j, CC_E, j->exit);
+  emit8(j, 0xFF); emit8(j, 0xE0); /* jmp rax */
+}
+
+static void flush_cycles(struct jit *j, uint32_t *pending) {
+  if (*pending) {
+    add64_imm(j, OFF(state.cycles), *pending);
+    *pending = 0;
+  }
+}
+
+static void emit_inline(struct jit *j, struct machine *m, uint8_t opcode, uint16_t pc) {
+  int dst = (opcode >> 3) & 0x7, src = opcode & 0x7, rp = (opcode >> 4) & 0x3;
+  uint16_t imm16 = (uint16_t) read_memory(m, (uint16_t) (pc + 2)) << 8 | read_memory(m, (uint16_t) (pc + 1));
+  uint8_t imm8 = read_memory(m, (uint16_t) (pc + 1));
+
+  if (opcode >= 0x40 && opcode < 0x80) {
+    if (src == MEM_REF) { /* MOV r,M */
+      load16(j, EAX, PAIR_OFF(HL));
+      load_guest_eax(j);
+    } else {
+      load8(j, EAX, REG_OFF(src));
+    }
+    store8(j, EAX, REG_OFF(dst));
+    return;
+  }
+
+  switch (opcode) {
+    case 0x00:
+      return;
+    case 0x0A: case 0x1A: /* LDAX */
+      load16(j, EAX, PAIR_OFF(rp));
+      load_guest_eax(j);
+      store8(j, EAX, REG_OFF(REG_A));
+      return;
+    case 0x3A: /* LDA; the map is fixed before anything is translated */
+      load8(j, EAX, OFF(memory) + (m->bus.phys[imm16 >> 8] << 8) + (imm16 & 0xFF));
+      store8(j, EAX, REG_OFF(REG_A));
+      return;
+    case 0x2F: /* CMA */
+      emit8(j, 0xF6); mem_rbx(j, 2, REG_OFF(REG_A)); /* not byte [a] */
+      return;
+    case 0x37: /* STC */
+      store8_imm(j, OFF(state.flag_cy), 1);
+      return;
+    case 0xEB: /* XCHG */
+      load16(j, EAX, PAIR_OFF(HL));
+      load16(j, ECX, PAIR_OFF(DE));
+      store16(j, ECX, PAIR_OFF(HL));
+      store16(j, EAX, PAIR_OFF(DE));
+      return;
+    case 0xF9: /* SPHL */
+      load16(j, EAX, PAIR_OFF(HL));
+      store16(j, EAX, OFF(state.sp));
+      return;
+    case 0xF3: /* DI */
+      store8_imm(j, OFF(state.interrupts_enabled), 0);
+      return;
+    case 0xFB: /* EI */
+      store8_imm(j, OFF(state.interrupts_enabled), 1);
+      return;
+  }
+
+  switch (opcode & 0xCF) {
+    case 0x01: /* LXI */
+      if (rp == SP) {
+        store16_imm(j, OFF(state.sp), imm16);
+      } else {
+        store16_imm(j, PAIR_OFF(rp), imm16);
+      }
+      return;
+    case 0x03: /* INX */
+    case 0x0B: /* DCX */
+      add16_imm(j, (rp == SP) ? OFF(state.sp) : PAIR_OFF(rp), (opcode & 0x08) ? -1 : 1);
+      return;
+  }
+
+  /* MVI r */
+  store8_imm(j, REG_OFF(dst), imm8);
+}
+
+static void unwatch_code(struct machine *m) {
+  int page;
+
+  for (page = 0; page < BUS_PAGES; page++)
+    bus_unwatch(m, page, WATCH_CODE);
+}
+
+static void flush_cache(struct machine *m) {
+  struct jit *j = m->jit;
+
+  memset(j->blocks, 0, sizeof(j->blocks));
+  memset(j->page_blocks, 0, sizeof(j->page_blocks));
+  memset(j->code_refs, 0, sizeof(j->code_refs));
+  memset(j->patch_head, 0xFF, sizeof(j->patch_head));
+  memset(j->exits, 0xFF, sizeof(j->exits));
+  j->npatches = 0;
+  j->nfree = 0;
+  j->ptr = j->start;
+
+  unwatch_code(m);
+  m->code_dirty = 0;
+  memset(m->code_bytes, 0, sizeof(m->code_bytes));
+  memset(m->code_dirty_bytes, 0, sizeof(m->code_dirty_bytes));
+}
+
+/* Points every chained jump to `target` at `entry` */
+static void link(struct jit *j, uint16_t target, uint8_t *entry) {
+  int p;
+
+  for (p = j->patch_head[target]; p >= 0; p = j->patches[p].next)
+    patch32(j->patches[p].site, entry);
+}
+
+/* The pages of memory[] the block at `start` overlaps: one, or two if it
+ * runs over a page boundary */
+static int block_pages(struct machine *m, uint16_t start, int pages[2]) {
+  uint16_t last = start + m->jit->lengths[start] - 1;
+
+  pages[0] = m->bus.phys[start >> 8];
+  pages[1] = m->bus.phys[last >> 8];
+  return (pages[1] != pages[0]) ? 2 : 1;
+}
+
+/* Adds `delta` to the blocks covering each byte of the block at `start`,
+ * keeping code_bytes and the page watches in step */
+static void cover(struct machine *m, uint16_t start, int delta) {
+  struct jit *j = m->jit;
+  uint16_t addr = start;
+  int pages[2], i, n = block_pages(m, start, pages), phys;
+  uint64_t bit;
+
+  for (i = 0; i < j->lengths[start]; i++, addr++) {
+    phys = m->bus.phys[addr >> 8] << 8 | (addr & 0xFF);
+    bit = (uint64_t) 1 << (phys & 63);
+    j->code_refs[phys] += delta;
+
+    if (j->code_refs[phys])
+      m->code_bytes[phys >> 6] |= bit;
+    else
+      m->code_bytes[phys >> 6] &= ~bit;
+  }
+
+  for (i = 0; i < n; i++) {
+    j->page_blocks[pages[i]] += delta;
+
+    if (j->page_blocks[pages[i]] == 0)
+      bus_unwatch(m, pages[i], WATCH_CODE);
+    else if (delta > 0 && j->page_blocks[pages[i]] == 1)
+      bus_watch(m, pages[i], WATCH_CODE);
+  }
+}
+
+/* Takes chain record `p` off its target's list and frees it */
+static void release_patch(struct jit *j, int p) {
+  int *prev = &j->patch_head[j->patches[p].target];
+
+  while (*prev != p)
+    prev = &j->patches[*prev].next;
+  *prev = j->patches[p].next;
+
+  j->patches[p].next = j->free_head;
+  j->free_head = p;
+  j->nfree++;
+}
+
+static void drop_block(struct machine *m, uint16_t start) {
+  struct jit *j = m->jit;
+  int i;
+
+  cover(m, start, -1);
+
+  for (i = 0; i < 2; i++)
+    if (j->exits[start][i] >= 0) {
+      release_patch(j, j->exits[start][i]);
+      j->exits[start][i] = -1;
+    }
+
+  link(j, start, j->exit);
+  j->blocks[start] = NULL;
+}
+
+/* Drops the blocks covering byte `phys` of memory[], at every guest address
+ * mapped onto it */
+static void invalidate_byte(struct machine *m, int phys) {
+  struct jit *j = m->jit;
+  int page, back;
+  uint16_t addr, start;
+
+  for (page = 0; page < BUS_PAGES; page++) {
+    if (m->bus.phys[page] != phys >> 8)
+      continue;
+
+    addr = page << 8 | (phys & 0xFF);
+    for (back = 0; back < JIT_MAX_BLOCK_BYTES; back++) {
+      start = addr - back;
+      if (j->blocks[start] != NULL && j->blocks[start] != j->exit && back < j->lengths[start])
+        drop_block(m, start);
+    }
+  }
+}
+
+/* Counts a code store to page `phys` of memory[], and leaves the page to the
+ * interpreter once they come too often */
+static void note_smc(struct machine *m, int phys) {
+  struct jit *j = m->jit;
+  uint64_t now = m->state.cycles;
+
+  if (now - j->smc_last[phys] > JIT_SMC_BACKOFF)
+    j->smc_count[phys] = 0;
+  j->smc_last[phys] = now;
+
+  if (++j->smc_count[phys] < JIT_SMC_LIMIT)
+    return;
+
+  j->smc_count[phys] = 0;
+  j->smc_until[phys] = now + ((uint64_t) JIT_SMC_BACKOFF << j->smc_strikes[phys]);
+  if (j->smc_strikes[phys] < JIT_SMC_MAX_STRIKES)
+    j->smc_strikes[phys]++;
+}
+
+/* Whether the code at `pc` is left to the interpreter */
+static int pinned(struct machine *m, uint16_t pc) {
+  return m->jit->smc_until[m->bus.phys[pc >> 8]] > m->state.cycles;
+}
+
+/* Hands page `phys` of memory[] back to the translator */
+static void unpin_page(struct machine *m, int phys) {
+  struct jit *j = m->jit;
+  int page, pc;
+
+  j->smc_until[phys] = 0;
+
+  for (page = 0; page < BUS_PAGES; page++)
+    if (m->bus.phys[page] == phys)
+      for (pc = page << 8; pc < (page + 1) << 8; pc++)
+        if (j->blocks[pc] == j->exit)
+          j->blocks[pc] = NULL;
+}
+
+/* Drops what the stores flagged in code_dirty_bytes have made stale */
+static void invalidate_dirty(struct machine *m) {
+  uint64_t dirty, pages[BUS_PAGES / 64] = {0};
+  int w, phys;
+
+  for (w = 0; w < (int) (sizeof(m->code_dirty_bytes) / sizeof(m->code_dirty_bytes[0])); w++) {
+    dirty = m->code_dirty_bytes[w];
+    m->code_dirty_bytes[w] = 0;
+
+    while (dirty) {
+      phys = w * 64 + __builtin_ctzll(dirty);
+      dirty &= dirty - 1;
+
+      invalidate_byte(m, phys);
+      pages[phys >> 14] |= (uint64_t) 1 << ((phys >> 8) & 63);
+    }
+  }
+
+  for (w = 0; w < BUS_PAGES / 64; w++)
+    for (dirty = pages[w]; dirty; dirty &= dirty - 1)
+      note_smc(m, w * 64 + __builtin_ctzll(dirty));
+
+  m->code_dirty = 0;
+}
+
+/* Translates the block starting at `start` and returns its entry point */
+static uint8_t *translate(struct machine *m, uint16_t start) {
+  struct jit *j = m->jit;
+  uint16_t pcs[JIT_MAX_BLOCK];
+  uint16_t pc = start, next;
+  uint32_t max_cycles = 0, pending = 0;
+  uint8_t opcode, *entry, *skip;
+  int n = 0, i, kind = KIND_INLINE, exits[2] = {-1, -1};
+
+  /* Decode first so the entry check knows the block's worst-case length */
+  while (n < JIT_MAX_BLOCK) {
+    opcode = read_memory(m, pc);
+    kind = classify(opcode);
+
+    if (kind == KIND_UNSUPPORTED || pinned(m, pc) || pinned(m, pc + opcode_length[opcode] - 1))
+      break;
+
+    pcs[n++] = pc;
+    max_cycles += opcode_cycles[opcode];
+    if ((opcode & 0xC7) == 0xC0 || (opcode & 0xC7) == 0xC4)
+      max_cycles += COND_TAKEN_CYCLES;
+    pc += opcode_length[opcode];
+
+    if (kind >= KIND_JUMP)
+      break;
+  }
+
+  if (n == 0) {
+    j->blocks[start] = j->exit; /* interpreter only */
+    return j->exit;
+  }
+
+  /* A block has at most two static exits */
+  if (j->ptr + (n + 4) * JIT_MAX_INSN_BYTES > j->code + JIT_CODE_SIZE || j->nfree + JIT_MAX_PATCHES - j->npatches < 2)
+    flush_cache(m);
+
+  entry = j->ptr;
+
+  /* mov rax, [cycles]; add rax, max; cmp rax, [run_limit]; jbe body */
+  emit8(j, 0x48); emit8(j, 0x8B); mem_rbx(j, EAX, OFF(state.cycles));
+  emit8(j, 0x48); emit8(j, 0x05); emit32(j, max_cycles);
+  emit8(j, 0x48); emit8(j, 0x3B); mem_rbx(j, EAX, OFF(run_limit));
+  emit8(j, 0x76); /* jbe */
+  skip = j->ptr;
+  emit8(j, 0);
+  store16_imm(j, OFF(state.pc), start);
+  jmp32(j, j->exit);
+  *skip = (uint8_t) (j->ptr - (skip + 1));
+
+  for (i = 0; i < n; i++) {
+    pc = pcs[i];
+    opcode = read_memory(m, pc);
+    kind = classify(opcode);
+    next = pc + opcode_length[opcode];
+    pending += opcode_cycles[opcode];
+
+    switch (kind) {
+      case KIND_INLINE:
+        emit_inline(j, m, opcode, pc);
+        break;
+
+      case KIND_CALL:
+      case KIND_CALL_STORE:
+        flush_cycles(j, &pending);
+        call_handler(j, opcode, pc);
+        if (kind == KIND_CALL_STORE)
+          check_dirty(j, i + 1);
+        break;
+
+      case KIND_JUMP:
+        flush_cycles(j, &pending);
+        if (opcode == 0xC3) {
+          exits[0] = exit_static(j, read_memory(m, (uint16_t) (pc + 2)) << 8 | read_memory(m, (uint16_t) (pc + 1)), i + 1);
+        } else {
+          uint8_t cond = (opcode >> 3) & 0x7, *taken;
+
+          taken = jcc32(j, emit_cond(j, cond), j->ptr);
+          exits[0] = exit_static(j, next, i + 1);
+          patch32(taken, j->ptr);
+          exits[1] = exit_static(j, read_memory(m, (uint16_t) (pc + 2)) << 8 | read_memory(m, (uint16_t) (pc + 1)), i + 1);
+        }
+        break;
+
+      case KIND_CALL_EXIT:
+      case KIND_RET_EXIT:
+        flush_cycles(j, &pending);
+        call_handler(j, opcode, pc);
+        if (kind == KIND_CALL_EXIT)
+          check_dirty(j, i + 1);
+        exit_dynamic(j, i + 1);
+        break;
+
+      case KIND_PCHL:
+        flush_cycles(j, &pending);
+        load16(j, EAX, PAIR_OFF(HL));
+        store16(j, EAX, OFF(state.pc));
+        exit_dynamic(j, i + 1);
+        break;
+    }
+  }
+
+  if (kind < KIND_JUMP) { /* ran out of room or hit an untranslatable opcode */
+    flush_cycles(j, &pending);
+    exits[0] = exit_static(j, pc + opcode_length[read_memory(m, pc)], n);
+  }
+
+  j->blocks[start] = entry;
+  j->exits[start][0] = exits[0];
+  j->exits[start][1] = exits[1];
+  j->lengths[start] = (uint16_t) (pcs[n - 1] + opcode_length[read_memory(m, pcs[n - 1])] - start);
+
+  cover(m, start, 1);
+  link(j, start, entry);
+  return entry;
+}
+
+/* Emits the trampoline into translated code and the shared exit stub */
+static void emit_stubs(struct jit *j) {
+  j->ptr = j->code;
+
+  j->enter = (void (*)(struct machine *, struct jit *, uint8_t *)) (void *) j->ptr;
+  emit8(j, 0x53); /* push rbx */
+  emit8(j, 0x41); emit8(j, 0x54); /* push r12 (keeps the stack 16-byte aligned) */
+  emit8(j, 0x41); emit8(j, 0x55); /* push r13 */
+  emit8(j, 0x48); emit8(j, 0x89); emit8(j, 0xFB); /* mov rbx, rdi */
+  emit8(j, 0x49); emit8(j, 0x89); emit8(j, 0xF5); /* mov r13, rsi */
+  emit8(j, 0xFF); emit8(j, 0xE2); /* jmp rdx */
+
+  j->exit = j->ptr;
+  emit8(j, 0x41); emit8(j, 0x5D); /* pop r13 */
+  emit8(j, 0x41); emit8(j, 0x5C); /* pop r12 */
+  emit8(j, 0x5B); /* pop rbx */
+  emit8(j, 0xC3); /* ret */
+
+  j->start = j->ptr;
+}
+
+void jit_init(struct machine *m) {
+  struct jit *j;
+
+  if ((j = calloc(1, sizeof(struct jit))) == NULL)
+    die_error("Could not allocate JIT\n");
+
+  j->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (j->code == MAP_FAILED)
+    die_error("mmap() of JIT code buffer failed\n");
+
+  m->jit = j;
+  emit_stubs(j);
+  flush_cache(m);
+}
+
+void jit_free(struct machine *m) {
+  if (m->jit == NULL)
+    return;
+
+  munmap(m->jit->code, JIT_CODE_SIZE);
+  free(m->jit);
+  m->jit = NULL;
+  unwatch_code(m);
+}
+
+void jit_flush(struct machine *m) {
+  flush_cache(m);
+}
+
+/* Runs translated code from the current pc until it leaves the cache, falling
+ * back to a single interpreted instruction when it cannot. Returns the number
+ * of guest instructions retired. */
+uint64_t jit_run(struct machine *m) {
+  struct jit *j = m->jit;
+  uint8_t *entry;
+  uint64_t n = 0;
+  int phys;
+
+  if (m->code_dirty)
+    invalidate_dirty(m);
+
+  if ((entry = j->blocks[m->state.pc]) == NULL)
+    entry = translate(m, m->state.pc);
+
+  if (entry == j->exit) {
+    phys = m->bus.phys[m->state.pc >> 8];
+    if (j->smc_until[phys] == 0 || j->smc_until[phys] > m->state.cycles) {
+      do {
+        step_dispatch(m);
+        n++;
+      } while (m->state.cycles < m->run_limit && j->blocks[m->state.pc] == j->exit);
+      return n;
+    }
+
+    unpin_page(m, phys);
+    entry = translate(m, m->state.pc);
+  }
+
+  j->instructions = 0;
+  j->enter(m, j, entry);
+
+  if (j->instructions == 0) {
+    step_dispatch(m);
+    return 1;
+  }
+
+  return j->instructions;
+}
+
+#else
+
+void jit_init(struct machine *m) {
+  die_error("The JIT core needs an x86-64 host\n");
+}
+
+void jit_free(struct machine *m) {
+}
+
+void jit_flush(struct machine *m) {
+}
+
+uint64_t jit_run(struct machine *m) {
+  step_dispatch(m);
+  return 1;
+}
+
+#endif
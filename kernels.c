@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <string.h>
+#include "emulator.h"
+
+/* Synthetic workloads for benchmarking. Each is a tight 8080 loop stressing
+ * one kind of instruction, loaded at KERNEL_ORG behind a prologue that
+ * disables interrupts and sets up a stack. Screen interrupts are still
+ * counted as frames, so headless runs report ns/frame as for a ROM. */
+
+#define KERNEL_ORG 0x0040
+
+struct kernel {
+  const char *name;
+  const uint8_t *code;
+  size_t length;
+};
+
+/*     MVI A,01  MVI B,03  MVI C,05  MVI D,11  MVI E,22
+ * l:  ADD B  ADC C  SUB D  SBB E  ANA C  ORA B  XRA D  CMP E
+ *     ADI 07  SUI 03  ANI FE  ORI 01  XRI 55  CPI 40
+ *     INR A  DCR B  INR C  CMA  RLC  RAR  STC  CMC  DAD B  INX D  DCX B
+ *     JMP l */
+static const uint8_t alu_kernel[] = {
+  0x3e, 0x01, 0x06, 0x03, 0x0e, 0x05, 0x16, 0x11, 0x1e, 0x22, 0x80, 0x89, 0x92, 0x9b, 0xa1, 0xb0,
+  0xaa, 0xbb, 0xc6, 0x07, 0xd6, 0x03, 0xe6, 0xfe, 0xf6, 0x01, 0xee, 0x55, 0xfe, 0x40, 0x3c, 0x05,
+  0x0c, 0x2f, 0x07, 0x1f, 0x37, 0x3f, 0x09, 0x13, 0x0b, 0xc3, 0x4a, 0x00
+};
+
+/*     LXI H,2000  LXI D,2080  LXI B,2040
+ * l:  MOV A,M  STAX D  LDAX B  MOV M,A  INR M  INR L  INR E  INR C
+ *     STA 20F0  LDA 20F1  SHLD 20F8  LHLD 20F8  MVI M,55  MOV D,M  MVI D,20
+ *     JMP l */
+static const uint8_t memory_kernel[] = {
+  0x21, 0x00, 0x20, 0x11, 0x80, 0x20, 0x01, 0x40, 0x20, 0x7e, 0x12, 0x0a, 0x77, 0x34, 0x2c, 0x1c,
+  0x0c, 0x32, 0xf0, 0x20, 0x3a, 0xf1, 0x20, 0x22, 0xf8, 0x20, 0x2a, 0xf8, 0x20, 0x36, 0x55, 0x56,
+  0x16, 0x20, 0xc3, 0x49, 0x00
+};
+
+/*     MVI B,00  MVI C,00
+ * l:  INR B  MOV A,B  ANI 03  JZ a  JPE b  JM c  JNC c
+ * a:  MOV A,B  ORA A  JP c  JMP b
+ * b:  DCR C  JNZ c
+ * c:  JMP l */
+static const uint8_t branch_kernel[] = {
+  0x06, 0x00, 0x0e, 0x00, 0x04, 0x78, 0xe6, 0x03, 0xca, 0x54, 0x00, 0xea, 0x5c, 0x00, 0xfa, 0x60,
+  0x00, 0xd2, 0x60, 0x00, 0x78, 0xb7, 0xf2, 0x60, 0x00, 0xc3, 0x5c, 0x00, 0x0d, 0xc2, 0x60, 0x00,
+  0xc3, 0x44, 0x00
+};
+
+/*     MVI B,00  MVI C,00
+ * l:  CALL f1  CALL f2  MOV A,B  ORA A  CZ f3  CNZ f3
+ *     PUSH B  PUSH D  POP D  POP B  INR B  JMP l
+ * f1: CALL f3  RET
+ * f2: INR C  RNZ  RET
+ * f3: RET */
+static const uint8_t call_kernel[] = {
+  0x06, 0x00, 0x0e, 0x00, 0xcd, 0x5a, 0x00, 0xcd, 0x5e, 0x00, 0x78, 0xb7, 0xcc, 0x61, 0x00, 0xc4,
+  0x61, 0x00, 0xc5, 0xd5, 0xd1, 0xc1, 0x04, 0xc3, 0x44, 0x00, 0xcd, 0x61, 0x00, 0xc9, 0x0c, 0xc0,
+  0xc9, 0xc9
+};
+
+static const struct kernel kernels[] = {
+  {"alu", alu_kernel, sizeof(alu_kernel)},
+  {"memory", memory_kernel, sizeof(memory_kernel)},
+  {"branch", branch_kernel, sizeof(branch_kernel)},
+  {"call", call_kernel, sizeof(call_kernel)},
+};
+
+void load_kernel(struct machine *m, char *name) {
+  /* DI; LXI SP,2400; JMP KERNEL_ORG */
+  static const uint8_t prologue[] = {0xf3, 0x31, 0x00, 0x24, 0xc3, KERNEL_ORG & 0xFF, KERNEL_ORG >> 8};
+  int i;
+
+  for (i = 0; i < (int) (sizeof(kernels) / sizeof(kernels[0])); i++) {
+    if (strcmp(kernels[i].name, name) == 0) {
+      memcpy(m->memory, prologue, sizeof(prologue));
+      memcpy(m->memory + KERNEL_ORG, kernels[i].code, kernels[i].length);
+      return;
+    }
+  }
+
+  die_error("Unknown kernel %s (alu, memory, branch, call)\n", name);
+}
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emulator.h"
+
+/* Input movies. A movie is the value of input ports 1 and 2 for every frame,
+ * so replaying it from the same starting point (power on or a save state)
+ * reproduces a run exactly, on any core and any host.
+ *
+ * For that to hold, the ports may only change at frame boundaries, also while
+ * recording: live input is held in `pending` and latched at vblank, where it
+ * is also appended to the file. Replay latches the recorded values at the same
+ * point and ignores live input.
+ *
+ * File layout: the 8-byte magic, a 32-bit version, then two bytes (port 1,
+ * port 2) per frame until the end of the file. Recording streams frames
+ * straight to disk, so a movie survives the window being closed. */
+
+#define MOVIE_MAGIC "8080MOVI"
+#define MOVIE_VERSION 1
+
+#define MOVIE_RECORD 0
+#define MOVIE_REPLAY 1
+
+struct movie {
+  int mode;
+  FILE *fp; /* recording */
+
+  uint8_t *frames; /* replay: port 1 and port 2 of each frame */
+  uint64_t length; /* frames in the movie */
+  uint64_t position; /* next frame to latch */
+
+  uint8_t pending[3]; /* recording: live port values for the next frame */
+};
+
+static struct movie *new_movie(struct machine *m, int mode) {
+  struct movie *mv;
+
+  if (m->movie != NULL)
+    die_error("Cannot record and replay a movie at the same time\n");
+
+  if ((mv = calloc(1, sizeof(struct movie))) == NULL)
+    die_error("Could not allocate movie\n");
+
+  mv->mode = mode;
+  m->movie = mv;
+  return mv;
+}
+
+void movie_record(struct machine *m, char *path) {
+  struct movie *mv = new_movie(m, MOVIE_RECORD);
+  uint32_t version = MOVIE_VERSION;
+
+  if ((mv->fp = fopen(path, "wb")) == NULL)
+    die_error("Could not open movie %s for writing\n", path);
+
+  if (fwrite(MOVIE_MAGIC, 8, 1, mv->fp) != 1 || fwrite(&version, sizeof(version), 1, mv->fp) != 1)
+    die_error("Could not write movie %s\n", path);
+
+  /* Start from whatever the ports hold now, as replay will */
+  mv->pending[1] = m->state.input_pins[1];
+  mv->pending[2] = m->state.input_pins[2];
+}
+
+void movie_replay(struct machine *m, char *path) {
+  struct movie *mv = new_movie(m, MOVIE_REPLAY);
+  char magic[8];
+  uint32_t version;
+  long size;
+  FILE *fp;
+
+  if ((fp = fopen(path, "rb")) == NULL)
+    die_error("Could not open movie %s\n", path);
+
+  if (fread(magic, 8, 1, fp) != 1 || memcmp(magic, MOVIE_MAGIC, 8) != 0 ||
+      fread(&version, sizeof(version), 1, fp) != 1)
+    die_error("%s is not a movie\n", path);
+
+  if (version != MOVIE_VERSION)
+    die_error("%s has version %u, expected %u\n", path, version, MOVIE_VERSION);
+
+  fseek(fp, 0, SEEK_END);
+  size = ftell(fp) - (8 + sizeof(version));
+  fseek(fp, 8 + sizeof(version), SEEK_SET);
+
+  mv->length = size / 2;
+  if ((mv->frames = malloc(size + 1)) == NULL)
+    die_error("Could not allocate movie\n");
+
+  if (fread(mv->frames, 1, size, fp) != (size_t) size)
+    die_error("Could not read movie %s\n", path);
+
+  fclose(fp);
+}
+
+void movie_free(struct machine *m) {
+  struct movie *mv = m->movie;
+
+  if (mv == NULL)
+    return;
+
+  if (mv->fp)
+    fclose(mv->fp);
+
+  free(mv->frames);
+  free(mv);
+  m->movie = NULL;
+}
+
+/* Frames in the movie being replayed, or 0 */
+uint64_t movie_length(struct machine *m) {
+  return (m->movie && m->movie->mode == MOVIE_REPLAY) ? m->movie->length : 0;
+}
+
+/* Where the frontend delivers live input for port 1 or 2 */
+void set_input_port(struct machine *m, int port, uint8_t value) {
+  struct movie *mv = m->movie;
+
+  if (mv == NULL)
+    m->state.input_pins[port] = value;
+  else if (mv->mode == MOVIE_RECORD)
+    mv->pending[port] = value;
+}
+
+/* Latches the ports for the frame that is starting. Called at vblank. */
+void movie_frame(struct machine *m) {
+  struct movie *mv = m->movie;
+
+  if (mv->mode == MOVIE_RECORD) {
+    m->state.input_pins[1] = mv->pending[1];
+    m->state.input_pins[2] = mv->pending[2];
+
+    if (fwrite(&mv->pending[1], 2, 1, mv->fp) != 1)
+      die_error("Could not write movie\n");
+    return;
+  }
+
+  if (mv->position < mv->length) { /* past the end the last values stay latched */
+    m->state.input_pins[1] = mv->frames[mv->position * 2];
+    m->state.input_pins[2] = mv->frames[mv->position * 2 + 1];
+    mv->position++;
+  }
+}
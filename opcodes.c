@@ -0,0 +1,280 @@
+#include "emulator.h"
+
+/* The 8080 instruction set, one line per opcode: how the switch core decodes
+ * it, how it is written, the operand that follows it, its clock cycles and
+ * the flags it can change. Everything that needs to know about opcodes works
+ * from this list -- execute(), init_dispatch(), the JIT's block decoder and the
+ * disassembler -- and the tables below are expanded from it at compile time.
+ *
+ * Conditional CALL and RET are listed at their not-taken cost; the branch
+ * handlers add COND_TAKEN_CYCLES when the condition holds (CALL 11/17, RET
+ * 5/11). Undocumented opcodes, marked with a '*', use the timing of the
+ * instruction they alias. */
+
+#define OPCODES(X) \
+/*  op    type           name    regs  operand     cyc   flags */ \
+  X(0x00, TYPE_NOP,      "NOP",   "",    OPERAND_NONE,  4, 0) \
+  X(0x01, TYPE_LXI,      "LXI",   "B",   OPERAND_D16,  10, 0) \
+  X(0x02, TYPE_STAX,     "STAX",  "B",   OPERAND_NONE,  7, 0) \
+  X(0x03, TYPE_INX,      "INX",   "B",   OPERAND_NONE,  5, 0) \
+  X(0x04, TYPE_INR,      "INR",   "B",   OPERAND_NONE,  5, SETS_Z | SETS_S | SETS_P | SETS_AC) \
+  X(0x05, TYPE_DCR,      "DCR",   "B",   OPERAND_NONE,  5, SETS_Z | SETS_S | SETS_P | SETS_AC) \
+  X(0x06, TYPE_MVI,      "MVI",   "B",   OPERAND_D8,    7, 0) \
+  X(0x07, TYPE_ROT,      "RLC",   "",    OPERAND_NONE,  4, SETS_CY) \
+  X(0x08, TYPE_UNKNOWN,  "*NOP",  "",    OPERAND_NONE,  4, 0) \
+  X(0x09, TYPE_DAD,      "DAD",   "B",   OPERAND_NONE, 10, SETS_CY) \
+  X(0x0A, TYPE_LDAX,     "LDAX",  "B",   OPERAND_NONE,  7, 0) \
+  X(0x0B, TYPE_DCX,      "DCX",   "B",   OPERAND_NONE,  5, 0) \
+  X(0x0C, TYPE_INR,      "INR",   "C",   OPERAND_NONE,  5, SETS_Z | SETS_S | SETS_P | SETS_AC) \
+  X(0x0D, TYPE_DCR,      "DCR",   "C",   OPERAND_NONE,  5, SETS_Z | SETS_S | SETS_P | SETS_AC) \
+  X(0x0E, TYPE_MVI,      "MVI",   "C",   OPERAND_D8,    7, 0) \
+  X(0x0F, TYPE_ROT,      "RRC",   "",    OPERAND_NONE,  4, SETS_CY) \
+  X(0x10, TYPE_UNKNOWN,  "*NOP",  "",    OPERAND_NONE,  4, 0) \
+  X(0x11, TYPE_LXI,      "LXI",   "D",   OPERAND_D16,  10, 0) \
+  X(0x12, TYPE_STAX,     "STAX",  "D",   OPERAND_NONE,  7, 0) \
+  X(0x13, TYPE_INX,      "INX",   "D",   OPERAND_NONE,  5, 0) \
+  X(0x14, TYPE_INR,      "INR",   "D",   OPERAND_NONE,  5, SETS_Z | SETS_S | SETS_P | SETS_AC) \
+  X(0x15, TYPE_DCR,      "DCR",   "D",   OPERAND_NONE,  5, SETS_Z | SETS_S | SETS_P | SETS_AC) \
+  X(0x16, TYPE_MVI,      "MVI",   "D",   OPERAND_D8,    7, 0) \
+  X(0x17, TYPE_ROT,      "RAL",   "",    OPERAND_NONE,  4, SETS_CY) \
+  X(0x18, TYPE_UNKNOWN,  "*NOP",  "",    OPERAND_NONE,  4, 0) \
+  X(0x19, TYPE_DAD,      "DAD",   "D",   OPERAND_NONE, 10, SETS_CY) \
+  X(0x1A, TYPE_LDAX,     "LDAX",  "D",   OPERAND_NONE,  7, 0) \
+  X(0x1B, TYPE_DCX,      "DCX",   "D",   OPERAND_NONE,  5, 0) \
+  X(0x1C, TYPE_INR,      "INR",   "E",   OPERAND_NONE,  5, SETS_Z | SETS_S | SETS_P | SETS_AC) \
+  X(0x1D, TYPE_DCR,      "DCR",   "E",   OPERAND_NONE,  5, SETS_Z | SETS_S | SETS_P | SETS_AC) \
+  X(0x1E, TYPE_MVI,      "MVI",   "E",   OPERAND_D8,    7, 0) \
+  X(0x1F, TYPE_ROT,      "RAR",   "",    OPERAND_NONE,  4, SETS_CY) \
+  X(0x20, TYPE_UNKNOWN,  "*NOP",  "",    OPERAND_NONE,  4, 0) \
+  X(0x21, TYPE_LXI,      "LXI",   "H",   OPERAND_D16,  10, 0) \
+  X(0x22, TYPE_DIR_ADDR, "SHLD",  "",    OPERAND_ADDR, 16, 0) \
+  X(0x23, TYPE_INX,      "INX",   "H",   OPERAND_NONE,  5, 0) \
+  X(0x24, TYPE_INR,      "INR",   "H",   OPERAND_NONE,  5, SETS_Z | SETS_S | SETS_P | SETS_AC) \
+  X(0x25, TYPE_DCR,      "DCR",   "H",   OPERAND_NONE,  5, SETS_Z | SETS_S | SETS_P | SETS_AC) \
+  X(0x26, TYPE_MVI,      "MVI",   "H",   OPERAND_D8,    7, 0) \
+  X(0x27, TYPE_DAA,      "DAA",   "",    OPERAND_NONE,  4, SETS_ALL) \
+  X(0x28, TYPE_UNKNOWN,  "*NOP",  "",    OPERAND_NONE,  4, 0) \
+  X(0x29, TYPE_DAD,      "DAD",   "H",   OPERAND_NONE, 10, SETS_CY) \
+  X(0x2A, TYPE_DIR_ADDR, "LHLD",  "",    OPERAND_ADDR, 16, 0) \
+  X(0x2B, TYPE_DCX,      "DCX",   "H",   OPERAND_NONE,  5, 0) \
+  X(0x2C, TYPE_INR,      "INR",   "L",   OPERAND_NONE,  5, SETS_Z | SETS_S | SETS_P | SETS_AC) \
+  X(0x2D, TYPE_DCR,      "DCR",   "L",   OPERAND_NONE,  5, SETS_Z | SETS_S | SETS_P | SETS_AC) \
+  X(0x2E, TYPE_MVI,      "MVI",   "L",   OPERAND_D8,    7, 0) \
+  X(0x2F, TYPE_CMA,      "CMA",   "",    OPERAND_NONE,  4, 0) \
+  X(0x30, TYPE_UNKNOWN,  "*NOP",  "",    OPERAND_NONE,  4, 0) \
+  X(0x31, TYPE_LXI,      "LXI",   "SP",  OPERAND_D16,  10, 0) \
+  X(0x32, TYPE_DIR_ADDR, "STA",   "",    OPERAND_ADDR, 13, 0) \
+  X(0x33, TYPE_INX,      "INX",   "SP",  OPERAND_NONE,  5, 0) \
+  X(0x34, TYPE_INR,      "INR",   "M",   OPERAND_NONE, 10, SETS_Z | SETS_S | SETS_P | SETS_AC) \
+  X(0x35, TYPE_DCR,      "DCR",   "M",   OPERAND_NONE, 10, SETS_Z | SETS_S | SETS_P | SETS_AC) \
+  X(0x36, TYPE_MVI,      "MVI",   "M",   OPERAND_D8,   10, 0) \
+  X(0x37, TYPE_STC,      "STC",   "",    OPERAND_NONE,  4, SETS_CY) \
+  X(0x38, TYPE_UNKNOWN,  "*NOP",  "",    OPERAND_NONE,  4, 0) \
+  X(0x39, TYPE_DAD,      "DAD",   "SP",  OPERAND_NONE, 10, SETS_CY) \
+  X(0x3A, TYPE_DIR_ADDR, "LDA",   "",    OPERAND_ADDR, 13, 0) \
+  X(0x3B, TYPE_DCX,      "DCX",   "SP",  OPERAND_NONE,  5, 0) \
+  X(0x3C, TYPE_INR,      "INR",   "A",   OPERAND_NONE,  5, SETS_Z | SETS_S | SETS_P | SETS_AC) \
+  X(0x3D, TYPE_DCR,      "DCR",   "A",   OPERAND_NONE,  5, SETS_Z | SETS_S | SETS_P | SETS_AC) \
+  X(0x3E, TYPE_MVI,      "MVI",   "A",   OPERAND_D8,    7, 0) \
+  X(0x3F, TYPE_CMC,      "CMC",   "",    OPERAND_NONE,  4, SETS_CY) \
+  X(0x40, TYPE_MOV,      "MOV",   "B,B", OPERAND_NONE,  5, 0) \
+  X(0x41, TYPE_MOV,      "MOV",   "B,C", OPERAND_NONE,  5, 0) \
+  X(0x42, TYPE_MOV,      "MOV",   "B,D", OPERAND_NONE,  5, 0) \
+  X(0x43, TYPE_MOV,      "MOV",   "B,E", OPERAND_NONE,  5, 0) \
+  X(0x44, TYPE_MOV,      "MOV",   "B,H", OPERAND_NONE,  5, 0) \
+  X(0x45, TYPE_MOV,      "MOV",   "B,L", OPERAND_NONE,  5, 0) \
+  X(0x46, TYPE_MOV,      "MOV",   "B,M", OPERAND_NONE,  7, 0) \
+  X(0x47, TYPE_MOV,      "MOV",   "B,A", OPERAND_NONE,  5, 0) \
+  X(0x48, TYPE_MOV,      "MOV",   "C,B", OPERAND_NONE,  5, 0) \
+  X(0x49, TYPE_MOV,      "MOV",   "C,C", OPERAND_NONE,  5, 0) \
+  X(0x4A, TYPE_MOV,      "MOV",   "C,D", OPERAND_NONE,  5, 0) \
+  X(0x4B, TYPE_MOV,      "MOV",   "C,E", OPERAND_NONE,  5, 0) \
+  X(0x4C, TYPE_MOV,      "MOV",   "C,H", OPERAND_NONE,  5, 0) \
+  X(0x4D, TYPE_MOV,      "MOV",   "C,L", OPERAND_NONE,  5, 0) \
+  X(0x4E, TYPE_MOV,      "MOV",   "C,M", OPERAND_NONE,  7, 0) \
+  X(0x4F, TYPE_MOV,      "MOV",   "C,A", OPERAND_NONE,  5, 0) \
+  X(0x50, TYPE_MOV,      "MOV",   "D,B", OPERAND_NONE,  5, 0) \
+  X(0x51, TYPE_MOV,      "MOV",   "D,C", OPERAND_NONE,  5, 0) \
+  X(0x52, TYPE_MOV,      "MOV",   "D,D", OPERAND_NONE,  5, 0) \
+  X(0x53, TYPE_MOV,      "MOV",   "D,E", OPERAND_NONE,  5, 0) \
+  X(0x54, TYPE_MOV,      "MOV",   "D,H", OPERAND_NONE,  5, 0) \
+  X(0x55, TYPE_MOV,      "MOV",   "D,L", OPERAND_NONE,  5, 0) \
+  X(0x56, TYPE_MOV,      "MOV",   "D,M", OPERAND_NONE,  7, 0) \
+  X(0x57, TYPE_MOV,      "MOV",   "D,A", OPERAND_NONE,  5, 0) \
+  X(0x58, TYPE_MOV,      "MOV",   "E,B", OPERAND_NONE,  5, 0) \
+  X(0x59, TYPE_MOV,      "MOV",   "E,C", OPERAND_NONE,  5, 0) \
+  X(0x5A, TYPE_MOV,      "MOV",   "E,D", OPERAND_NONE,  5, 0) \
+  X(0x5B, TYPE_MOV,      "MOV",   "E,E", OPERAND_NONE,  5, 0) \
+  X(0x5C, TYPE_MOV,      "MOV",   "E,H", OPERAND_NONE,  5, 0) \
+  X(0x5D, TYPE_MOV,      "MOV",   "E,L", OPERAND_NONE,  5, 0) \
+  X(0x5E, TYPE_MOV,      "MOV",   "E,M", OPERAND_NONE,  7, 0) \
+  X(0x5F, TYPE_MOV,      "MOV",   "E,A", OPERAND_NONE,  5, 0) \
+  X(0x60, TYPE_MOV,      "MOV",   "H,B", OPERAND_NONE,  5, 0) \
+  X(0x61, TYPE_MOV,      "MOV",   "H,C", OPERAND_NONE,  5, 0) \
+  X(0x62, TYPE_MOV,      "MOV",   "H,D", OPERAND_NONE,  5, 0) \
+  X(0x63, TYPE_MOV,      "MOV",   "H,E", OPERAND_NONE,  5, 0) \
+  X(0x64, TYPE_MOV,      "MOV",   "H,H", OPERAND_NONE,  5, 0) \
+  X(0x65, TYPE_MOV,      "MOV",   "H,L", OPERAND_NONE,  5, 0) \
+  X(0x66, TYPE_MOV,      "MOV",   "H,M", OPERAND_NONE,  7, 0) \
+  X(0x67, TYPE_MOV,      "MOV",   "H,A", OPERAND_NONE,  5, 0) \
+  X(0x68, TYPE_MOV,      "MOV",   "L,B", OPERAND_NONE,  5, 0) \
+  X(0x69, TYPE_MOV,      "MOV",   "L,C", OPERAND_NONE,  5, 0) \
+  X(0x6A, TYPE_MOV,      "MOV",   "L,D", OPERAND_NONE,  5, 0) \
+  X(0x6B, TYPE_MOV,      "MOV",   "L,E", OPERAND_NONE,  5, 0) \
+  X(0x6C, TYPE_MOV,      "MOV",   "L,H", OPERAND_NONE,  5, 0) \
+  X(0x6D, TYPE_MOV,      "MOV",   "L,L", OPERAND_NONE,  5, 0) \
+  X(0x6E, TYPE_MOV,      "MOV",   "L,M", OPERAND_NONE,  7, 0) \
+  X(0x6F, TYPE_MOV,      "MOV",   "L,A", OPERAND_NONE,  5, 0) \
+  X(0x70, TYPE_MOV,      "MOV",   "M,B", OPERAND_NONE,  7, 0) \
+  X(0x71, TYPE_MOV,      "MOV",   "M,C", OPERAND_NONE,  7, 0) \
+  X(0x72, TYPE_MOV,      "MOV",   "M,D", OPERAND_NONE,  7, 0) \
+  X(0x73, TYPE_MOV,      "MOV",   "M,E", OPERAND_NONE,  7, 0) \
+  X(0x74, TYPE_MOV,      "MOV",   "M,H", OPERAND_NONE,  7, 0) \
+  X(0x75, TYPE_MOV,      "MOV",   "M,L", OPERAND_NONE,  7, 0) \
+  X(0x76, TYPE_HLT,      "HLT",   "",    OPERAND_NONE,  7, 0) \
+  X(0x77, TYPE_MOV,      "MOV",   "M,A", OPERAND_NONE,  7, 0) \
+  X(0x78, TYPE_MOV,      "MOV",   "A,B", OPERAND_NONE,  5, 0) \
+  X(0x79, TYPE_MOV,      "MOV",   "A,C", OPERAND_NONE,  5, 0) \
+  X(0x7A, TYPE_MOV,      "MOV",   "A,D", OPERAND_NONE,  5, 0) \
+  X(0x7B, TYPE_MOV,      "MOV",   "A,E", OPERAND_NONE,  5, 0) \
+  X(0x7C, TYPE_MOV,      "MOV",   "A,H", OPERAND_NONE,  5, 0) \
+  X(0x7D, TYPE_MOV,      "MOV",   "A,L", OPERAND_NONE,  5, 0) \
+  X(0x7E, TYPE_MOV,      "MOV",   "A,M", OPERAND_NONE,  7, 0) \
+  X(0x7F, TYPE_MOV,      "MOV",   "A,A", OPERAND_NONE,  5, 0) \
+  X(0x80, TYPE_ALR,      "ADD",   "B",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x81, TYPE_ALR,      "ADD",   "C",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x82, TYPE_ALR,      "ADD",   "D",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x83, TYPE_ALR,      "ADD",   "E",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x84, TYPE_ALR,      "ADD",   "H",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x85, TYPE_ALR,      "ADD",   "L",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x86, TYPE_ALR,      "ADD",   "M",   OPERAND_NONE,  7, SETS_ALL) \
+  X(0x87, TYPE_ALR,      "ADD",   "A",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x88, TYPE_ALR,      "ADC",   "B",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x89, TYPE_ALR,      "ADC",   "C",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x8A, TYPE_ALR,      "ADC",   "D",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x8B, TYPE_ALR,      "ADC",   "E",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x8C, TYPE_ALR,      "ADC",   "H",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x8D, TYPE_ALR,      "ADC",   "L",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x8E, TYPE_ALR,      "ADC",   "M",   OPERAND_NONE,  7, SETS_ALL) \
+  X(0x8F, TYPE_ALR,      "ADC",   "A",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x90, TYPE_ALR,      "SUB",   "B",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x91, TYPE_ALR,      "SUB",   "C",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x92, TYPE_ALR,      "SUB",   "D",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x93, TYPE_ALR,      "SUB",   "E",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x94, TYPE_ALR,      "SUB",   "H",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x95, TYPE_ALR,      "SUB",   "L",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x96, TYPE_ALR,      "SUB",   "M",   OPERAND_NONE,  7, SETS_ALL) \
+  X(0x97, TYPE_ALR,      "SUB",   "A",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x98, TYPE_ALR,      "SBB",   "B",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x99, TYPE_ALR,      "SBB",   "C",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x9A, TYPE_ALR,      "SBB",   "D",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x9B, TYPE_ALR,      "SBB",   "E",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x9C, TYPE_ALR,      "SBB",   "H",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x9D, TYPE_ALR,      "SBB",   "L",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0x9E, TYPE_ALR,      "SBB",   "M",   OPERAND_NONE,  7, SETS_ALL) \
+  X(0x9F, TYPE_ALR,      "SBB",   "A",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xA0, TYPE_ALR,      "ANA",   "B",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xA1, TYPE_ALR,      "ANA",   "C",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xA2, TYPE_ALR,      "ANA",   "D",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xA3, TYPE_ALR,      "ANA",   "E",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xA4, TYPE_ALR,      "ANA",   "H",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xA5, TYPE_ALR,      "ANA",   "L",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xA6, TYPE_ALR,      "ANA",   "M",   OPERAND_NONE,  7, SETS_ALL) \
+  X(0xA7, TYPE_ALR,      "ANA",   "A",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xA8, TYPE_ALR,      "XRA",   "B",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xA9, TYPE_ALR,      "XRA",   "C",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xAA, TYPE_ALR,      "XRA",   "D",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xAB, TYPE_ALR,      "XRA",   "E",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xAC, TYPE_ALR,      "XRA",   "H",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xAD, TYPE_ALR,      "XRA",   "L",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xAE, TYPE_ALR,      "XRA",   "M",   OPERAND_NONE,  7, SETS_ALL) \
+  X(0xAF, TYPE_ALR,      "XRA",   "A",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xB0, TYPE_ALR,      "ORA",   "B",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xB1, TYPE_ALR,      "ORA",   "C",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xB2, TYPE_ALR,      "ORA",   "D",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xB3, TYPE_ALR,      "ORA",   "E",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xB4, TYPE_ALR,      "ORA",   "H",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xB5, TYPE_ALR,      "ORA",   "L",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xB6, TYPE_ALR,      "ORA",   "M",   OPERAND_NONE,  7, SETS_ALL) \
+  X(0xB7, TYPE_ALR,      "ORA",   "A",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xB8, TYPE_ALR,      "CMP",   "B",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xB9, TYPE_ALR,      "CMP",   "C",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xBA, TYPE_ALR,      "CMP",   "D",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xBB, TYPE_ALR,      "CMP",   "E",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xBC, TYPE_ALR,      "CMP",   "H",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xBD, TYPE_ALR,      "CMP",   "L",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xBE, TYPE_ALR,      "CMP",   "M",   OPERAND_NONE,  7, SETS_ALL) \
+  X(0xBF, TYPE_ALR,      "CMP",   "A",   OPERAND_NONE,  4, SETS_ALL) \
+  X(0xC0, TYPE_JUMP,     "RNZ",   "",    OPERAND_NONE,  5, 0) \
+  X(0xC1, TYPE_POP,      "POP",   "B",   OPERAND_NONE, 10, 0) \
+  X(0xC2, TYPE_JUMP,     "JNZ",   "",    OPERAND_ADDR, 10, 0) \
+  X(0xC3, TYPE_JUMP,     "JMP",   "",    OPERAND_ADDR, 10, 0) \
+  X(0xC4, TYPE_JUMP,     "CNZ",   "",    OPERAND_ADDR, 11, 0) \
+  X(0xC5, TYPE_PUSH,     "PUSH",  "B",   OPERAND_NONE, 11, 0) \
+  X(0xC6, TYPE_ALI,      "ADI",   "",    OPERAND_D8,    7, SETS_ALL) \
+  X(0xC7, TYPE_RST,      "RST",   "0",   OPERAND_NONE, 11, 0) \
+  X(0xC8, TYPE_JUMP,     "RZ",    "",    OPERAND_NONE,  5, 0) \
+  X(0xC9, TYPE_JUMP,     "RET",   "",    OPERAND_NONE, 10, 0) \
+  X(0xCA, TYPE_JUMP,     "JZ",    "",    OPERAND_ADDR, 10, 0) \
+  X(0xCB, TYPE_JUMP,     "*JMP",  "",    OPERAND_ADDR, 10, 0) \
+  X(0xCC, TYPE_JUMP,     "CZ",    "",    OPERAND_ADDR, 11, 0) \
+  X(0xCD, TYPE_JUMP,     "CALL",  "",    OPERAND_ADDR, 17, 0) \
+  X(0xCE, TYPE_ALI,      "ACI",   "",    OPERAND_D8,    7, SETS_ALL) \
+  X(0xCF, TYPE_RST,      "RST",   "1",   OPERAND_NONE, 11, 0) \
+  X(0xD0, TYPE_JUMP,     "RNC",   "",    OPERAND_NONE,  5, 0) \
+  X(0xD1, TYPE_POP,      "POP",   "D",   OPERAND_NONE, 10, 0) \
+  X(0xD2, TYPE_JUMP,     "JNC",   "",    OPERAND_ADDR, 10, 0) \
+  X(0xD3, TYPE_OUT,      "OUT",   "",    OPERAND_PORT, 10, 0) \
+  X(0xD4, TYPE_JUMP,     "CNC",   "",    OPERAND_ADDR, 11, 0) \
+  X(0xD5, TYPE_PUSH,     "PUSH",  "D",   OPERAND_NONE, 11, 0) \
+  X(0xD6, TYPE_ALI,      "SUI",   "",    OPERAND_D8,    7, SETS_ALL) \
+  X(0xD7, TYPE_RST,      "RST",   "2",   OPERAND_NONE, 11, 0) \
+  X(0xD8, TYPE_JUMP,     "RC",    "",    OPERAND_NONE,  5, 0) \
+  X(0xD9, TYPE_JUMP,     "*RET",  "",    OPERAND_NONE, 10, 0) \
+  X(0xDA, TYPE_JUMP,     "JC",    "",    OPERAND_ADDR, 10, 0) \
+  X(0xDB, TYPE_IN,       "IN",    "",    OPERAND_PORT, 10, 0) \
+  X(0xDC, TYPE_JUMP,     "CC",    "",    OPERAND_ADDR, 11, 0) \
+  X(0xDD, TYPE_JUMP,     "*CALL", "",    OPERAND_ADDR, 17, 0) \
+  X(0xDE, TYPE_ALI,      "SBI",   "",    OPERAND_D8,    7, SETS_ALL) \
+  X(0xDF, TYPE_RST,      "RST",   "3",   OPERAND_NONE, 11, 0) \
+  X(0xE0, TYPE_JUMP,     "RPO",   "",    OPERAND_NONE,  5, 0) \
+  X(0xE1, TYPE_POP,      "POP",   "H",   OPERAND_NONE, 10, 0) \
+  X(0xE2, TYPE_JUMP,     "JPO",   "",    OPERAND_ADDR, 10, 0) \
+  X(0xE3, TYPE_XTHL,     "XTHL",  "",    OPERAND_NONE, 18, 0) \
+  X(0xE4, TYPE_JUMP,     "CPO",   "",    OPERAND_ADDR, 11, 0) \
+  X(0xE5, TYPE_PUSH,     "PUSH",  "H",   OPERAND_NONE, 11, 0) \
+  X(0xE6, TYPE_ALI,      "ANI",   "",    OPERAND_D8,    7, SETS_ALL) \
+  X(0xE7, TYPE_RST,      "RST",   "4",   OPERAND_NONE, 11, 0) \
+  X(0xE8, TYPE_JUMP,     "RPE",   "",    OPERAND_NONE,  5, 0) \
+  X(0xE9, TYPE_PCHL,     "PCHL",  "",    OPERAND_NONE,  5, 0) \
+  X(0xEA, TYPE_JUMP,     "JPE",   "",    OPERAND_ADDR, 10, 0) \
+  X(0xEB, TYPE_XCHG,     "XCHG",  "",    OPERAND_NONE,  4, 0) \
+  X(0xEC, TYPE_JUMP,     "CPE",   "",    OPERAND_ADDR, 11, 0) \
+  X(0xED, TYPE_JUMP,     "*CALL", "",    OPERAND_ADDR, 17, 0) \
+  X(0xEE, TYPE_ALI,      "XRI",   "",    OPERAND_D8,    7, SETS_ALL) \
+  X(0xEF, TYPE_RST,      "RST",   "5",   OPERAND_NONE, 11, 0) \
+  X(0xF0, TYPE_JUMP,     "RP",    "",    OPERAND_NONE,  5, 0) \
+  X(0xF1, TYPE_POP,      "POP",   "PSW", OPERAND_NONE, 10, SETS_ALL) \
+  X(0xF2, TYPE_JUMP,     "JP",    "",    OPERAND_ADDR, 10, 0) \
+  X(0xF3, TYPE_DI,       "DI",    "",    OPERAND_NONE,  4, 0) \
+  X(0xF4, TYPE_JUMP,     "CP",    "",    OPERAND_ADDR, 11, 0) \
+  X(0xF5, TYPE_PUSH,     "PUSH",  "PSW", OPERAND_NONE, 11, 0) \
+  X(0xF6, TYPE_ALI,      "ORI",   "",    OPERAND_D8,    7, SETS_ALL) \
+  X(0xF7, TYPE_RST,      "RST",   "6",   OPERAND_NONE, 11, 0) \
+  X(0xF8, TYPE_JUMP,     "RM",    "",    OPERAND_NONE,  5, 0) \
+  X(0xF9, TYPE_SPHL,     "SPHL",  "",    OPERAND_NONE,  5, 0) \
+  X(0xFA, TYPE_JUMP,     "JM",    "",    OPERAND_ADDR, 10, 0) \
+  X(0xFB, TYPE_EI,       "EI",    "",    OPERAND_NONE,  4, 0) \
+  X(0xFC, TYPE_JUMP,     "CM",    "",    OPERAND_ADDR, 11, 0) \
+  X(0xFD, TYPE_JUMP,     "*CALL", "",    OPERAND_ADDR, 17, 0) \
+  X(0xFE, TYPE_ALI,      "CPI",   "",    OPERAND_D8,    7, SETS_ALL) \
+  X(0xFF, TYPE_RST,      "RST",   "7",   OPERAND_NONE, 11, 0)
+
+#define SPEC(opcode, type, mnemonic, registers, operand, cycles, flags) \
+  [opcode] = {type, operand, flags, mnemonic, registers},
+#define CYCLES(opcode, type, mnemonic, registers, operand, cycles, flags) [opcode] = cycles,
+#define LENGTH(opcode, type, mnemonic, registers, operand, cycles, flags) [opcode] = 1 + OPERAND_BYTES(operand),
+
+const struct opcode_spec opcode_specs[256] = { OPCODES(SPEC) };
+const uint8_t opcode_cycles[256] = { OPCODES(CYCLES) };
+const uint8_t opcode_length[256] = { OPCODES(LENGTH) };
@@ -0,0 +1,112 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "emulator.h"
+
+/* Runs many independent headless machines across a pool of threads. Each
+ * instance starts as a copy of a template machine (ROM already loaded) and
+ * runs for a fixed number of frames or cycles. Workers pull instances off a shared
+ * counter, so the pool stays busy however unevenly instances finish. */
+
+struct pool {
+  struct machine *template;
+  int core;
+  int instances;
+  uint64_t frames;
+  uint64_t cycles;
+
+  atomic_int next; /* index of the next instance to run */
+
+  pthread_mutex_t lock; /* protects total */
+  struct run_stats total;
+};
+
+static void *worker(void *arg) {
+  struct pool *pool = arg;
+  struct run_stats stats, sum;
+  struct machine *m;
+
+  memset(&sum, 0, sizeof(sum));
+
+  if ((m = malloc(sizeof(struct machine))) == NULL)
+    die_error("Could not allocate machine\n");
+
+  while (atomic_fetch_add(&pool->next, 1) < pool->instances) {
+    memcpy(m, pool->template, sizeof(struct machine));
+    bus_rebase(m); /* the copied page table still points into the template */
+
+    if (pool->core == CORE_JIT)
+      jit_init(m);
+
+    run_headless(m, pool->core, pool->frames, pool->cycles, &stats);
+    jit_free(m);
+
+    sum.instructions += stats.instructions;
+    sum.cycles += stats.cycles;
+    sum.frames += stats.frames;
+    sum.idle_cycles += stats.idle_cycles;
+  }
+
+  free(m);
+
+  pthread_mutex_lock(&pool->lock);
+  pool->total.instructions += sum.instructions;
+  pool->total.cycles += sum.cycles;
+  pool->total.frames += sum.frames;
+  pool->total.idle_cycles += sum.idle_cycles;
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+/* Runs `instances` copies of `template` on `threads` threads (0 = one per
+ * online CPU), each for `frames` frames or `cycles` cycles as run_headless()
+ * does. `total` receives the summed counters and the wall time of the whole
+ * batch. */
+void run_pool(struct machine *template, int core, int instances, int threads, uint64_t frames, uint64_t cycles,
+              struct run_stats *total) {
+  struct pool pool;
+  pthread_t *tids;
+  struct timespec start, end;
+  int i;
+
+  if (template->frontend != NULL)
+    die_error("run_pool() needs a headless template machine\n");
+
+  if (threads <= 0)
+    threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads > instances)
+    threads = instances;
+
+  pool.template = template;
+  pool.core = core;
+  pool.instances = instances;
+  pool.frames = frames;
+  pool.cycles = cycles;
+  atomic_init(&pool.next, 0);
+  pthread_mutex_init(&pool.lock, NULL);
+  memset(&pool.total, 0, sizeof(pool.total));
+
+  if ((tids = calloc(threads, sizeof(pthread_t))) == NULL)
+    die_error("Could not allocate thread pool\n");
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (i = 0; i < threads; i++)
+    if (pthread_create(&tids[i], NULL, worker, &pool) != 0)
+      die_error("pthread_create() failed\n");
+
+  for (i = 0; i < threads; i++)
+    pthread_join(tids[i], NULL);
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  free(tids);
+  pthread_mutex_destroy(&pool.lock);
+
+  *total = pool.total;
+  total->seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "emulator.h"
+
+/* Execution profiler, built in with -DPROFILE (see `make profile`). The
+ * interpreter loops wrap every instruction in PROFILE_BEGIN/PROFILE_END, which
+ * expand to nothing otherwise, so regular builds pay nothing for it. Blocks run
+ * by the JIT are not seen; profile with the switch or dispatch core. */
+
+#ifdef PROFILE
+
+void profile_record(struct machine *m, uint16_t pc, uint8_t opcode, uint32_t cycles) {
+  struct profile *p = &m->profile;
+
+  p->op_count[opcode]++;
+  p->op_cycles[opcode] += cycles;
+  p->pc_count[pc]++;
+  p->pc_cycles[pc] += cycles;
+  p->pairs[p->last_op][opcode]++;
+  p->last_op = opcode;
+  p->total++;
+}
+
+static const uint64_t *sort_key; /* qsort() has no context argument */
+
+static int by_key_desc(const void *a, const void *b) {
+  uint64_t x = sort_key[*(const int *) a], y = sort_key[*(const int *) b];
+
+  return (x < y) - (x > y);
+}
+
+/* Indices 0..n-1 ordered by descending key[i] */
+static int *sorted(const uint64_t *key, int n) {
+  int *index, i;
+
+  if ((index = malloc(n * sizeof(int))) == NULL)
+    die_error("Could not allocate profile report\n");
+
+  for (i = 0; i < n; i++)
+    index[i] = i;
+
+  sort_key = key;
+  qsort(index, n, sizeof(int), by_key_desc);
+  return index;
+}
+
+static double percent(uint64_t n, uint64_t total) {
+  return total ? 100.0 * n / total : 0.0;
+}
+
+void print_profile(struct machine *m, int top) {
+  struct profile *p = &m->profile;
+  static uint8_t view[MEMSIZE];
+  int *index, i, op, hottest[256];
+  uint64_t total_cycles = 0;
+  char text[32];
+
+  for (op = 0; op < 256; op++)
+    total_cycles += p->op_cycles[op];
+
+  if (p->total == 0) {
+    printf("\nprofile: no interpreted instructions (the JIT core is not profiled)\n");
+    return;
+  }
+
+  /* Memory as the CPU sees it, which differs from memory[] on remapped pages */
+  for (i = 0; i < MEMSIZE; i++)
+    view[i] = read_memory(m, i);
+
+  /* Disassemble each opcode where it runs most, so operands show up too */
+  for (op = 0; op < 256; op++)
+    hottest[op] = -1;
+  index = sorted(p->pc_count, MEMSIZE);
+  for (i = MEMSIZE - 1; i >= 0; i--)
+    if (p->pc_count[index[i]])
+      hottest[view[index[i]]] = index[i];
+
+  printf("\nhottest PCs (of %llu instructions, %llu cycles):\n", (unsigned long long) p->total,
+         (unsigned long long) total_cycles);
+  printf("   count       %%      cycles       %%  instruction\n");
+  for (i = 0; i < top && p->pc_count[index[i]]; i++) {
+    printf("%12llu %6.2f %11llu %6.2f  ", (unsigned long long) p->pc_count[index[i]],
+           percent(p->pc_count[index[i]], p->total), (unsigned long long) p->pc_cycles[index[i]],
+           percent(p->pc_cycles[index[i]], total_cycles));
+    disassemble8080(view, index[i], text, sizeof(text));
+    printf("%s\n", text);
+  }
+  free(index);
+
+  printf("\nopcodes:\n");
+  printf("   count       %%      cycles       %%  op  hottest instance\n");
+  index = sorted(p->op_count, 256);
+  for (i = 0; i < 256 && p->op_count[index[i]]; i++) {
+    op = index[i];
+    printf("%12llu %6.2f %11llu %6.2f  %02x  ", (unsigned long long) p->op_count[op], percent(p->op_count[op], p->total),
+           (unsigned long long) p->op_cycles[op], percent(p->op_cycles[op], total_cycles), op);
+    if (hottest[op] >= 0) {
+      disassemble8080(view, hottest[op], text, sizeof(text));
+      printf("%s\n", text);
+    } else
+      printf("\n");
+  }
+  free(index);
+
+  printf("\nopcode pairs:\n");
+  printf("   count       %%  first  second\n");
+  index = sorted(&p->pairs[0][0], 256 * 256);
+  for (i = 0; i < top && (&p->pairs[0][0])[index[i]]; i++) {
+    printf("%12llu %6.2f  %02x     %02x\n", (unsigned long long) (&p->pairs[0][0])[index[i]],
+           percent((&p->pairs[0][0])[index[i]], p->total), index[i] >> 8, index[i] & 0xFF);
+  }
+  free(index);
+}
+
+#endif
@@ -0,0 +1,257 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "emulator.h"
+
+/* Rewind history. At every vblank we append a record holding the CPU state and
+ * the 256-byte memory pages that changed since the previous vblank, stored as
+ * the XOR of old and new contents and run-length encoded (mostly zeros, since
+ * few bytes of a page change per frame). XOR deltas are their own inverse, so
+ * stepping back one frame is just XORing that record's pages into memory.
+ *
+ * Records of varying size live back to back in a fixed byte arena used as a
+ * ring; once it is full the oldest frames are dropped. A separate ring of
+ * offsets gives O(1) access to the newest records.
+ *
+ * Changed pages are found by watching every page on the bus. The first store
+ * to a page in a frame marks it in page_dirty and drops the watch, so later
+ * stores take the fast path; the watch is restored once the page is saved. */
+
+#define PAGE_SIZE 256
+#define MAX_RECORDS 65536 /* about 18 minutes at 60 frames a second */
+
+/* Largest record entry for a page: its index byte, then the encoding. A delta
+ * alternating nonzero and zero bytes is the worst case, three bytes (literal
+ * token, byte, zero-run token) for every two. */
+#define MAX_PAGE_BYTES (1 + PAGE_SIZE + PAGE_SIZE / 2)
+
+struct record {
+  uint32_t size; /* of the record including the page data that follows */
+  uint16_t pages; /* number of encoded pages that follow */
+  struct state state;
+  struct shifter shifter;
+};
+
+struct rewind {
+  uint8_t shadow[MEMSIZE]; /* memory as of the newest record */
+
+  uint8_t *arena;
+  size_t capacity;
+  size_t tail; /* where the next record goes */
+
+  uint32_t offsets[MAX_RECORDS]; /* arena offset of each record, oldest first */
+  int first; /* index of the oldest record in offsets */
+  int count;
+
+  uint8_t scratch[sizeof(struct record) + (MEMSIZE / PAGE_SIZE) * MAX_PAGE_BYTES + 7]; /* + alignment */
+};
+
+void rewind_init(struct machine *m, size_t bytes) {
+  struct rewind *r;
+  int page;
+
+  /* One record must always fit, however much of memory changed */
+  if (bytes < sizeof(r->scratch))
+    bytes = sizeof(r->scratch);
+
+  if ((r = calloc(1, sizeof(struct rewind))) == NULL || (r->arena = malloc(bytes)) == NULL)
+    die_error("Could not allocate rewind buffer\n");
+
+  r->capacity = bytes;
+  memcpy(r->shadow, m->memory, MEMSIZE);
+  memset(m->page_dirty, 0, sizeof(m->page_dirty));
+  for (page = 0; page < BUS_PAGES; page++)
+    bus_watch(m, page, WATCH_DIRTY);
+  m->rewind = r;
+}
+
+void rewind_free(struct machine *m) {
+  int page;
+
+  if (m->rewind == NULL)
+    return;
+
+  for (page = 0; page < BUS_PAGES; page++)
+    bus_unwatch(m, page, WATCH_DIRTY);
+
+  free(m->rewind->arena);
+  free(m->rewind);
+  m->rewind = NULL;
+}
+
+static struct record *record_at(struct rewind *r, int i) {
+  return (struct record *) (r->arena + r->offsets[(r->first + i) % MAX_RECORDS]);
+}
+
+static void drop_oldest(struct rewind *r) {
+  r->first = (r->first + 1) % MAX_RECORDS;
+  r->count--;
+}
+
+/* Encodes page ^ shadow as tokens: 0x80|(n-1) skips n zero bytes, n-1 is
+ * followed by n literal bytes. Brings the shadow page up to date. */
+static int encode_page(uint8_t *out, const uint8_t *page, uint8_t *shadow) {
+  uint8_t delta[PAGE_SIZE];
+  int i, n, len = 0;
+
+  for (i = 0; i < PAGE_SIZE; i++)
+    delta[i] = page[i] ^ shadow[i];
+  memcpy(shadow, page, PAGE_SIZE);
+
+  for (i = 0; i < PAGE_SIZE; i += n) {
+    if (delta[i] == 0) {
+      for (n = 1; n < 128 && i + n < PAGE_SIZE && delta[i + n] == 0; n++)
+        ;
+      out[len++] = 0x80 | (n - 1);
+    } else {
+      for (n = 1; n < 128 && i + n < PAGE_SIZE && delta[i + n] != 0; n++)
+        ;
+      out[len++] = n - 1;
+      memcpy(out + len, delta + i, n);
+      len += n;
+    }
+  }
+
+  return len;
+}
+
+/* XORs an encoded delta into both copies of a page. Returns the encoded length. */
+static int apply_page(const uint8_t *in, uint8_t *page, uint8_t *shadow) {
+  int i = 0, len = 0, n, k;
+
+  while (i < PAGE_SIZE) {
+    n = (in[len] & 0x7F) + 1;
+
+    if (in[len++] & 0x80) {
+      i += n;
+      continue;
+    }
+
+    for (k = 0; k < n; k++, i++) {
+      page[i] ^= in[len + k];
+      shadow[i] ^= in[len + k];
+    }
+    len += n;
+  }
+
+  return len;
+}
+
+/* Appends the current frame to the history. Called at vblank. */
+void rewind_capture(struct machine *m) {
+  struct rewind *r = m->rewind;
+  struct record *rec = (struct record *) r->scratch;
+  uint8_t *out = r->scratch + sizeof(struct record);
+  uint64_t dirty;
+  int w, page;
+  size_t size, old_tail;
+
+  rec->pages = 0;
+  rec->state = m->state;
+  rec->shifter = m->shifter;
+
+  for (w = 0; w < (int) (sizeof(m->page_dirty) / sizeof(m->page_dirty[0])); w++) {
+    dirty = m->page_dirty[w];
+    m->page_dirty[w] = 0;
+
+    while (dirty) {
+      page = w * 64 + __builtin_ctzll(dirty);
+      dirty &= dirty - 1;
+      bus_watch(m, page, WATCH_DIRTY);
+
+      *out++ = page;
+      out += encode_page(out, m->memory + page * PAGE_SIZE, r->shadow + page * PAGE_SIZE);
+      rec->pages++;
+    }
+  }
+
+  size = (out - r->scratch + 7) & ~(size_t) 7; /* keep records aligned */
+  rec->size = size;
+
+  /* Records are never split. Wrapping abandons the gap at the end of the
+   * arena along with the oldest records still living in it. */
+  old_tail = r->tail;
+  if (r->tail + size > r->capacity) {
+    while (r->count > 0 && r->offsets[r->first] >= old_tail)
+      drop_oldest(r);
+    r->tail = 0;
+  }
+
+  while (r->count > 0 && r->offsets[r->first] >= r->tail && r->offsets[r->first] < r->tail + size)
+    drop_oldest(r);
+
+  if (r->count == MAX_RECORDS)
+    drop_oldest(r);
+
+  memcpy(r->arena + r->tail, r->scratch, size);
+  r->offsets[(r->first + r->count) % MAX_RECORDS] = r->tail;
+  r->count++;
+  r->tail += size;
+}
+
+/* Steps back to the vblank `frames` frames before the most recent one
+ * (0 = back to the most recent one). Returns how many frames were actually
+ * rewound, which is less than asked if the history does not go back that
+ * far. Rewound frames are removed from the history. */
+int rewind_frames(struct machine *m, int frames) {
+  struct rewind *r = m->rewind;
+  struct record *rec;
+  const uint8_t *in;
+  uint64_t dirty;
+  int w, page, i, k;
+
+  if (r == NULL || r->count == 0)
+    return 0;
+
+  if (frames > r->count - 1)
+    frames = r->count - 1;
+
+  /* Undo whatever was written since the newest record */
+  for (w = 0; w < (int) (sizeof(m->page_dirty) / sizeof(m->page_dirty[0])); w++) {
+    dirty = m->page_dirty[w];
+    m->page_dirty[w] = 0;
+
+    while (dirty) {
+      page = w * 64 + __builtin_ctzll(dirty);
+      dirty &= dirty - 1;
+      bus_watch(m, page, WATCH_DIRTY);
+      memcpy(m->memory + page * PAGE_SIZE, r->shadow + page * PAGE_SIZE, PAGE_SIZE);
+    }
+  }
+
+  /* Each record's pages take memory from its own frame to the one before */
+  for (i = 0; i < frames; i++) {
+    rec = record_at(r, r->count - 1);
+    in = (const uint8_t *) (rec + 1);
+
+    for (k = 0; k < rec->pages; k++) {
+      page = *in++;
+      in += apply_page(in, m->memory + page * PAGE_SIZE, r->shadow + page * PAGE_SIZE);
+    }
+
+    r->count--;
+    r->tail = r->offsets[(r->first + r->count) % MAX_RECORDS];
+  }
+
+  rec = record_at(r, r->count - 1);
+  m->state = rec->state;
+  m->shifter = rec->shifter;
+
+  if (m->jit)
+    jit_flush(m); /* translated code may no longer match memory */
+  memset(m->vram_dirty, 0xFF, sizeof(m->vram_dirty));
+
+  return frames;
+}
+
+void print_rewind_stats(struct machine *m) {
+  struct rewind *r = m->rewind;
+  size_t used = 0;
+  int i;
+
+  for (i = 0; i < r->count; i++)
+    used += record_at(r, i)->size;
+
+  printf("rewind:       %d frames in %zu bytes (%.0f bytes/frame)\n", r->count, used,
+         r->count ? (double) used / r->count : 0.0);
+}
@@ -0,0 +1,202 @@
+#include "emulator.h"
+
+/* Batch execution for embedding the core in a host loop. run_until() runs
+ * guest instructions back to back and only comes back when one of these
+ * happens:
+ *
+ *   RUN_BUDGET     the requested cycle count was reached
+ *   RUN_INTERRUPT  a screen interrupt is due; call screen_interrupt()
+ *   RUN_OUT        an OUT hit a port registered with watch_port(); the port
+ *                  and value are in m->out_port and m->out_byte
+ *   RUN_BREAK      the next instruction is at a breakpoint
+ *   RUN_STOP       the program stopped the machine (CP/M warm boot)
+ *
+ * Each core's inner loop is a single compare of the cycle counter against
+ * m->run_limit. Events end the batch by pulling run_limit down to zero, so
+ * they cost nothing while they are not happening.
+ *
+ * Idle loops. The game spends most of each frame spinning on a RAM flag that
+ * only an interrupt handler changes. Unless m->idle_skip is off, the cores run
+ * in slices of IDLE_SLICE cycles and after each one we probe the current pc:
+ * single-step instructions that cannot store, touch the stack, do I/O or
+ * change the interrupt state, and see whether we come back to the same pc
+ * with every register and flag as before. If so, the loop has reached a fixed
+ * point, and as nothing but an interrupt can change the memory it reads, every
+ * further iteration up to the interrupt would be identical. Those iterations
+ * are skipped by advancing the cycle counter; the last one, which the
+ * interrupt lands in, still runs normally, so it fires on the same instruction
+ * as without skipping. */
+
+#define IDLE_SLICE 4096 /* cycles between idle probes */
+#define IDLE_MAX_LOOP 16 /* longest loop probed, in instructions */
+
+/* Ends the running batch after the current instruction */
+void end_batch(struct machine *m, int event) {
+  m->run_event = event;
+  m->run_limit = 0;
+}
+
+void set_breakpoint(struct machine *m, uint16_t addr, int on) {
+  uint64_t bit = (uint64_t) 1 << (addr & 63);
+
+  if (on && !(m->breakpoints[addr >> 6] & bit)) {
+    m->breakpoints[addr >> 6] |= bit;
+    m->breakpoint_count++;
+  } else if (!on && (m->breakpoints[addr >> 6] & bit)) {
+    m->breakpoints[addr >> 6] &= ~bit;
+    m->breakpoint_count--;
+  }
+}
+
+void watch_port(struct machine *m, uint8_t port, int on) {
+  if (on)
+    m->out_ports[port >> 6] |= (uint64_t) 1 << (port & 63);
+  else
+    m->out_ports[port >> 6] &= ~((uint64_t) 1 << (port & 63));
+}
+
+/* Single-steps so every pc can be checked. The instruction a batch starts on
+ * always runs, so calling again resumes from a breakpoint. */
+static uint64_t run_breakpoints(struct machine *m, int core) {
+  void (*step)(struct machine *) = (core == CORE_SWITCH) ? step_switch : step_dispatch;
+  uint64_t n = 0;
+
+  while (m->state.cycles < m->run_limit) {
+    step(m);
+    n++;
+
+    if (m->breakpoints[m->state.pc >> 6] & ((uint64_t) 1 << (m->state.pc & 63))) {
+      end_batch(m, RUN_BREAK);
+      break;
+    }
+  }
+
+  return n;
+}
+
+/* Instructions an idle loop may contain */
+static int idle_safe(uint8_t opcode) {
+  if (opcode >= 0x40 && opcode < 0x80) /* MOV, except stores and HLT */
+    return (opcode & 0xF8) != 0x70;
+
+  if (opcode >= 0x80 && opcode < 0xC0) /* ALU with a register or M */
+    return 1;
+
+  switch (opcode) {
+    case 0x00: /* NOP */
+    case 0x0A: case 0x1A: case 0x2A: case 0x3A: /* LDAX, LHLD, LDA */
+    case 0x07: case 0x0F: case 0x17: case 0x1F: /* rotates */
+    case 0x27: case 0x2F: case 0x37: case 0x3F: /* DAA, CMA, STC, CMC */
+    case 0xC3: case 0xEB: /* JMP, XCHG */
+      return 1;
+    case 0x34: case 0x35: case 0x36: /* INR M, DCR M, MVI M */
+      return 0;
+  }
+
+  switch (opcode & 0xCF) {
+    case 0x01: case 0x03: case 0x09: case 0x0B: /* LXI, INX, DAD, DCX */
+      return 1;
+  }
+
+  switch (opcode & 0xC7) {
+    case 0x04: case 0x05: case 0x06: /* INR, DCR, MVI */
+    case 0xC2: /* Jcc */
+    case 0xC6: /* ALU immediate */
+      return 1;
+  }
+
+  return 0;
+}
+
+static int same_registers(const struct state *a, const struct state *b) {
+  return a->pairs[BC] == b->pairs[BC] && a->pairs[DE] == b->pairs[DE] && a->pairs[HL] == b->pairs[HL] &&
+         a->reg_a == b->reg_a && a->sp == b->sp && a->flag_zsp == b->flag_zsp && a->flag_cy == b->flag_cy &&
+         a->flag_ac == b->flag_ac && a->interrupts_enabled == b->interrupts_enabled;
+}
+
+/* Runs at most one loop iteration from the current pc, and if it proves to be
+ * an idle loop skips the iterations that fit before run_limit */
+static void skip_idle(struct machine *m, int core) {
+  void (*step)(struct machine *) = (core == CORE_SWITCH) ? step_switch : step_dispatch;
+  struct state before = m->state;
+  uint64_t period, skipped;
+  int n;
+
+  for (n = 0; n < IDLE_MAX_LOOP && m->state.cycles < m->run_limit; n++) {
+    if (!idle_safe(read_memory(m, m->state.pc)))
+      return;
+
+    step(m);
+    m->instructions++;
+
+    if (m->state.pc == before.pc)
+      break;
+  }
+
+  if (m->state.pc != before.pc || !same_registers(&before, &m->state) || m->state.cycles >= m->run_limit)
+    return;
+
+  period = m->state.cycles - before.cycles;
+  skipped = (m->run_limit - m->state.cycles - 1) / period * period;
+  m->state.cycles += skipped;
+  m->idle_cycles += skipped;
+}
+
+static uint64_t run_core(struct machine *m, int core) {
+  uint64_t n = 0;
+
+  if (m->breakpoint_count > 0) /* the JIT cannot stop inside a block */
+    return run_breakpoints(m, core);
+
+  if (core == CORE_JIT) {
+    while (m->state.cycles < m->run_limit)
+      n += jit_run(m);
+    return n;
+  }
+
+  return (core == CORE_DISPATCH) ? run_dispatch(m) : run_switch(m);
+}
+
+/* Runs until the cycle counter reaches `cycle` or an event happens, and
+ * returns which. The instruction that crosses the limit completes, exactly as
+ * an interrupt waits for the current instruction. */
+int run_until(struct machine *m, int core, uint64_t cycle) {
+  uint64_t limit;
+
+  if (m->stopped)
+    return RUN_STOP;
+
+  if (m->state.cycles >= m->state.next_interrupt)
+    return RUN_INTERRUPT;
+
+  if (cycle < m->state.next_interrupt) {
+    m->run_limit = cycle;
+    m->run_event = RUN_BUDGET;
+  } else {
+    m->run_limit = m->state.next_interrupt;
+    m->run_event = RUN_INTERRUPT;
+  }
+
+  if (!m->idle_skip || m->breakpoint_count > 0) {
+    m->instructions += run_core(m, core);
+    return m->run_event;
+  }
+
+  limit = m->run_limit;
+  while (m->state.cycles < limit) {
+    m->run_limit = (limit - m->state.cycles > IDLE_SLICE) ? m->state.cycles + IDLE_SLICE : limit;
+    m->instructions += run_core(m, core);
+
+    if (m->run_limit == 0) /* an event */
+      break;
+
+    m->run_limit = limit;
+    skip_idle(m, core);
+  }
+
+  return m->run_event;
+}
+
+int run_cycles(struct machine *m, int core, uint64_t cycles) {
+  return run_until(m, core, m->state.cycles + cycles);
+}
@@ -0,0 +1,96 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "emulator.h"
+
+/* Save states are one fixed-layout record: a small header followed by the
+ * machine's state, memory and shift register exactly as they sit in struct
+ * machine. Loading maps the file and copies the three blocks back, so restore
+ * costs about one 64 KB memcpy. The layout follows the host's struct layout;
+ * bump SAVESTATE_VERSION whenever struct state or struct shifter change. */
+
+#define SAVESTATE_MAGIC "8080SAVE"
+#define SAVESTATE_VERSION 2
+
+struct savestate {
+  char magic[8];
+  uint32_t version;
+  uint32_t size; /* sizeof(struct savestate), catches layout changes we forgot to version */
+  struct state state; /* registers, flags and interrupt/timing state */
+  struct shifter shifter;
+  uint8_t memory[MEMSIZE];
+};
+
+void save_state(struct machine *m, char *path) {
+  struct savestate *s;
+  FILE *fp;
+
+  if ((s = calloc(1, sizeof(struct savestate))) == NULL)
+    die_error("Could not allocate save state\n");
+
+  memcpy(s->magic, SAVESTATE_MAGIC, sizeof(s->magic));
+  s->version = SAVESTATE_VERSION;
+  s->size = sizeof(struct savestate);
+  s->state = m->state;
+  s->shifter = m->shifter;
+  memcpy(s->memory, m->memory, MEMSIZE);
+
+  if ((fp = fopen(path, "wb")) == NULL)
+    die_error("Could not open save state %s for writing\n", path);
+
+  if (fwrite(s, sizeof(struct savestate), 1, fp) != 1)
+    die_error("Could not write save state %s\n", path);
+
+  fclose(fp);
+  free(s);
+}
+
+static double now_us() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Replaces the machine's state with the snapshot at `path`. Returns the time
+ * the restore took in microseconds. */
+double load_state(struct machine *m, char *path) {
+  const struct savestate *s;
+  struct stat st;
+  double start = now_us();
+  int fd;
+
+  if ((fd = open(path, O_RDONLY)) < 0)
+    die_error("Could not open save state %s\n", path);
+
+  if (fstat(fd, &st) < 0 || st.st_size != sizeof(struct savestate))
+    die_error("%s is not a save state for this build\n", path);
+
+  if ((s = mmap(NULL, sizeof(struct savestate), PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+    die_error("Could not map save state %s\n", path);
+
+  close(fd);
+
+  if (memcmp(s->magic, SAVESTATE_MAGIC, sizeof(s->magic)) != 0)
+    die_error("%s is not a save state\n", path);
+
+  if (s->version != SAVESTATE_VERSION || s->size != sizeof(struct savestate))
+    die_error("%s has version %u, expected %u\n", path, s->version, SAVESTATE_VERSION);
+
+  m->state = s->state;
+  m->shifter = s->shifter;
+  memcpy(m->memory, s->memory, MEMSIZE);
+
+  munmap((void *) s, sizeof(struct savestate));
+
+  if (m->jit)
+    jit_flush(m); /* translated code may no longer match memory */
+  memset(m->vram_dirty, 0xFF, sizeof(m->vram_dirty));
+
+  return now_us() - start;
+}
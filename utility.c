@@ -1,28 +1,55 @@
+#include <stdio.h>
 #include "emulator.h"
 
-uint8_t get_flagbyte() {
-  uint8_t flagbyte = 0;
-  flagbyte = 0x02 | ((1 << 7) & state.flag_s) | ((1 << 6) & state.flag_z) |
-    ((1 << 4) & state.flag_ac) | ((1 << 2) & state.flag_p) | state.flag_cy;
+/* Flags are evaluated lazily. ALU, INR and DCR only record their 8-bit result
+ * in flag_zsp; Z, S and P are worked out from it when get_cond(),
+ * get_flagbyte() or the debugger ask. The carry is cheap to produce and is
+ * read by ADC, SBB, RAL and RAR, so it is kept in flag_cy as before. */
 
-  return flagbyte;
+#define P2(n) n, n ^ 1, n ^ 1, n
+#define P4(n) P2(n), P2(n ^ 1), P2(n ^ 1), P2(n)
+#define P6(n) P4(n), P4(n ^ 1), P4(n ^ 1), P4(n)
+
+/* 1 when the byte has an even number of set bits */
+const uint8_t parity_table[256] = { P6(1), P6(0), P6(0), P6(1) };
+
+uint8_t get_flagbyte(struct machine *m) {
+  struct state *s = &m->state;
+
+  FLAG_STAT(m, flag_reads);
+  FLAG_STAT(m, parity_reads);
+  return (flag_s(s) << 7) | (flag_z(s) << 6) | (s->flag_ac << 4) | (flag_p(s) << 2) | 0x02 | s->flag_cy;
 }
 
-void restore_flags(uint8_t flagbyte) {
-  state.flag_s = flagbyte & (1 << 7);
-  state.flag_z = flagbyte & (1 << 6);
-  state.flag_ac = flagbyte & (1 << 4);
-  state.flag_p = flagbyte & (1 << 2);
-  state.flag_cy = flagbyte & 1;
+/* Re-encodes arbitrary Z/S/P values into flag_zsp, using the override bits
+ * for combinations no single result byte can produce */
+void restore_flags(struct machine *m, uint8_t flagbyte) {
+  int z = (flagbyte >> 6) & 1, s = (flagbyte >> 7) & 1, p = (flagbyte >> 2) & 1;
+  uint16_t zsp;
+
+  if (z)
+    zsp = s ? ZSP_FORCE_S : 0x00;
+  else
+    zsp = s ? 0x80 : 0x01;
+
+  if (parity_table[zsp & 0xFF] != p)
+    zsp |= ZSP_FLIP_P;
+
+  m->state.flag_zsp = zsp;
+  m->state.flag_ac = (flagbyte >> 4) & 1;
+  m->state.flag_cy = flagbyte & 1;
 }
 
 int check_parity(uint8_t byte) {
-  unsigned int count = 0, i, b = 1;
-
-  for (i = 0; i < 8; i++) {
-    if (byte & (b << i) )
-      count++;
-  }
+  return parity_table[byte];
+}
 
-  return !(count % 2);
+#ifdef FLAG_STATS
+void print_flag_stats(struct machine *m) {
+  printf("flag updates: %llu\n", (unsigned long long) m->flag_updates);
+  printf("flag reads:   %llu (%.1f%% of updates)\n", (unsigned long long) m->flag_reads,
+         m->flag_updates ? 100.0 * m->flag_reads / m->flag_updates : 0.0);
+  printf("parity reads: %llu (%.1f%% of updates)\n", (unsigned long long) m->parity_reads,
+         m->flag_updates ? 100.0 * m->parity_reads / m->flag_updates : 0.0);
 }
+#endif
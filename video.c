@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "emulator.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+/* Converts 1bpp video RAM to 32-bit pixels.
+ *
+ * The monitor is mounted rotated 90 degrees: VRAM byte o holds eight
+ * vertically stacked pixels of column o / 32, bottom-up, starting at row
+ * 255 - (o % 32) * 8. Converting byte by byte therefore scatters pixels with a
+ * stride of a whole row. Instead we work on 8x8 tiles: the eight bytes that
+ * share o % 32 in eight neighbouring columns are transposed as a bit matrix so
+ * that each resulting byte is one row of eight adjacent pixels, which a kernel
+ * then expands in one go. Tiles line up with the dirty bitmap: the 32 tiles of
+ * a column group are exactly four of its words. */
+
+#define GROUPS (SCREEN_WIDTH / 8) /* 8-pixel column groups */
+#define GROUP_BYTES 256 /* VRAM bytes per column group */
+
+static void tile_scalar(const struct renderer *r, uint32_t *pixels, int stride, int group, int row, uint64_t bits) {
+  int k, x;
+  uint32_t *dst, color;
+  uint8_t b;
+
+  for (k = 0; k < 8; k++, bits >>= 8) {
+    dst = pixels + (row - k) * stride + group * 8;
+    color = r->color[row - k][group];
+    b = bits & 0xFF;
+
+    for (x = 0; x < 8; x++)
+      dst[x] = -(uint32_t) ((b >> x) & 1) & color;
+  }
+}
+
+#if defined(__x86_64__)
+
+static void tile_sse2(const struct renderer *r, uint32_t *pixels, int stride, int group, int row, uint64_t bits) {
+  const __m128i lo = _mm_setr_epi32(0x01, 0x02, 0x04, 0x08);
+  const __m128i hi = _mm_setr_epi32(0x10, 0x20, 0x40, 0x80);
+  __m128i b, color;
+  uint32_t *dst;
+  int k;
+
+  for (k = 0; k < 8; k++, bits >>= 8) {
+    dst = pixels + (row - k) * stride + group * 8;
+    color = _mm_set1_epi32(r->color[row - k][group]);
+    b = _mm_set1_epi32(bits & 0xFF);
+
+    _mm_storeu_si128((__m128i *) dst, _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(b, lo), lo), color));
+    _mm_storeu_si128((__m128i *) (dst + 4), _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(b, hi), hi), color));
+  }
+}
+
+__attribute__((target("avx2")))
+static void tile_avx2(const struct renderer *r, uint32_t *pixels, int stride, int group, int row, uint64_t bits) {
+  const __m256i sel = _mm256_setr_epi32(0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80);
+  __m256i b, color;
+  int k;
+
+  for (k = 0; k < 8; k++, bits >>= 8) {
+    color = _mm256_set1_epi32(r->color[row - k][group]);
+    b = _mm256_set1_epi32(bits & 0xFF);
+
+    _mm256_storeu_si256((__m256i *) (pixels + (row - k) * stride + group * 8),
+                        _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_and_si256(b, sel), sel), color));
+  }
+}
+
+#endif
+
+/* Byte q of x holds bits of column q; afterwards byte k holds bit k of every
+ * column, i.e. one pixel row (Hacker's Delight, 7-3) */
+static uint64_t transpose8(uint64_t x) {
+  x = (x & 0xAA55AA55AA55AA55ull) | ((x & 0x00AA00AA00AA00AAull) << 7) | ((x >> 7) & 0x00AA00AA00AA00AAull);
+  x = (x & 0xCCCC3333CCCC3333ull) | ((x & 0x0000CCCC0000CCCCull) << 14) | ((x >> 14) & 0x0000CCCC0000CCCCull);
+  x = (x & 0xF0F0F0F00F0F0F0Full) | ((x & 0x00000000F0F0F0F0ull) << 28) | ((x >> 28) & 0x00000000F0F0F0F0ull);
+  return x;
+}
+
+/* The cabinet had coloured cellophane over the monitor: red across the UFO
+ * row, green over the shields and player, and green over the lives area at
+ * the bottom left (rounded out to whole 8-pixel groups) */
+static uint32_t overlay_color(int x, int y, uint32_t white, uint32_t red, uint32_t green) {
+  if (y >= 32 && y < 64)
+    return red;
+  if (y >= 184 && y < 240)
+    return green;
+  if (y >= 240 && x >= 16 && x < 136)
+    return green;
+  return white;
+}
+
+void init_renderer(struct renderer *r, uint32_t white, uint32_t red, uint32_t green, int overlay) {
+  int y, g;
+
+  for (y = 0; y < SCREEN_HEIGHT; y++)
+    for (g = 0; g < GROUPS; g++)
+      r->color[y][g] = overlay ? overlay_color(g * 8, y, white, red, green) : white;
+
+  r->tile = tile_scalar;
+#if defined(__x86_64__)
+  r->tile = tile_sse2; /* baseline on x86-64 */
+  if (__builtin_cpu_supports("avx2"))
+    r->tile = tile_avx2;
+#endif
+}
+
+static void render_group(struct machine *m, const struct renderer *r, int group, uint32_t tiles,
+                         uint32_t *pixels, int stride) {
+  const uint8_t *src = &m->memory[VRAM_START + group * GROUP_BYTES];
+  uint64_t x;
+  int t, q;
+
+  while (tiles) {
+    t = __builtin_ctz(tiles);
+    tiles &= tiles - 1;
+
+    for (x = 0, q = 0; q < 8; q++)
+      x |= (uint64_t) src[q * 32 + t] << (q * 8);
+
+    r->tile(r, pixels, stride, group, SCREEN_HEIGHT - 1 - t * 8, transpose8(x));
+  }
+}
+
+/* Converts the tiles of one half of the screen that changed since they were
+ * last drawn and clears their dirty bits. `stride` is the surface pitch in
+ * pixels. Returns how many tiles were converted. */
+int render_half(struct machine *m, const struct renderer *r, int half, uint32_t *pixels, int stride) {
+  int g, first, last, count = 0;
+  uint64_t *w, any;
+  uint32_t tiles;
+
+  /* Byte 0x3400 is what space invaders considers the "middle" */
+  first = (half == MIDDLE) ? 0 : (0x3400 - VRAM_START) / GROUP_BYTES;
+  last = (half == MIDDLE) ? (0x3400 - VRAM_START) / GROUP_BYTES : GROUPS;
+
+  for (g = first; g < last; g++) {
+    w = &m->vram_dirty[g * (GROUP_BYTES / 64)];
+    any = w[0] | w[1] | w[2] | w[3];
+
+    if (!any)
+      continue;
+
+    /* Bit t of either 32-bit half of a word belongs to tile t */
+    tiles = (uint32_t) (any | (any >> 32));
+    w[0] = w[1] = w[2] = w[3] = 0;
+
+    render_group(m, r, g, tiles, pixels, stride);
+    count += __builtin_popcount(tiles);
+  }
+
+  return count;
+}
+
+/* Microbenchmark */
+
+/* The pixel-at-a-time conversion copy_half() used before, minus the
+ * SDL_MapRGB() call it made per lit pixel */
+static void render_reference(struct machine *m, uint32_t *pixels, uint32_t white) {
+  int i, j, k, col, row;
+  uint8_t byte;
+
+  for (i = 0, j = VRAM_START; j < VRAM_START + VRAM_SIZE; j++) {
+    byte = m->memory[j];
+
+    for (k = 0; k < 8; k++, i++, byte >>= 1) {
+      col = i / SCREEN_HEIGHT;
+      row = SCREEN_HEIGHT - (i % SCREEN_HEIGHT) - 1;
+      pixels[SCREEN_WIDTH * row + col] = (byte & 0x01) ? white : 0;
+    }
+  }
+}
+
+static double now_ns() {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Times full-frame conversion of the machine's current screen with every
+ * available kernel and checks each against the reference */
+void bench_video(struct machine *m, int iterations) {
+  static uint32_t expect[SCREEN_WIDTH * SCREEN_HEIGHT], got[SCREEN_WIDTH * SCREEN_HEIGHT];
+  static const struct {
+    const char *name;
+    void (*tile)(const struct renderer *, uint32_t *, int, int, int, uint64_t);
+  } kernels[] = {
+    {"scalar", tile_scalar},
+#if defined(__x86_64__)
+    {"sse2", tile_sse2},
+    {"avx2", tile_avx2},
+#endif
+  };
+  static struct renderer r;
+  double start, ns, ref;
+  int i, k;
+
+  init_renderer(&r, 0xFFFFFFFF, 0, 0, 0);
+
+  start = now_ns();
+  for (i = 0; i < iterations; i++)
+    render_reference(m, expect, 0xFFFFFFFF);
+  ref = (now_ns() - start) / iterations;
+  printf("%-10s %9.0f ns/frame\n", "reference", ref);
+
+  for (k = 0; k < (int) (sizeof(kernels) / sizeof(kernels[0])); k++) {
+#if defined(__x86_64__)
+    if (kernels[k].tile == tile_avx2 && !__builtin_cpu_supports("avx2"))
+      continue;
+#endif
+    r.tile = kernels[k].tile;
+    memset(got, 0x55, sizeof(got));
+
+    start = now_ns();
+    for (i = 0; i < iterations; i++) {
+      memset(m->vram_dirty, 0xFF, sizeof(m->vram_dirty));
+      render_half(m, &r, MIDDLE, got, SCREEN_WIDTH);
+      render_half(m, &r, BOTTOM, got, SCREEN_WIDTH);
+    }
+    ns = (now_ns() - start) / iterations;
+
+    printf("%-10s %9.0f ns/frame  %5.1fx  %s\n", kernels[k].name, ns, ref / ns,
+           memcmp(got, expect, sizeof(got)) ? "MISMATCH" : "ok");
+  }
+}